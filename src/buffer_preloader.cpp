@@ -0,0 +1,122 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "buffer_preloader.h"
+
+#include "latency_stats.h"
+
+#include <coreplugin/editormanager/ieditor.h>
+
+#include <algorithm>
+
+namespace QNVim {
+namespace Internal {
+
+BufferPreloader::BufferPreloader(Loader loader, QObject *parent)
+    : QObject{parent}, mLoader{std::move(loader)} {
+    mTimer.setSingleShot(true);
+    connect(&mTimer, &QTimer::timeout, this, &BufferPreloader::process);
+    mLastActivity.start();
+    report();
+}
+
+void BufferPreloader::enqueue(Core::IEditor *editor) {
+    if (not editor or mQueue.contains(editor))
+        return;
+
+    mQueue << editor;
+    sort();
+    report();
+    schedule();
+}
+
+void BufferPreloader::remove(Core::IEditor *editor) {
+    mQueue.removeAll(editor);
+    mHistory.removeAll(editor);
+    report();
+}
+
+void BufferPreloader::clear() {
+    mTimer.stop();
+    mQueue.clear();
+    report();
+}
+
+void BufferPreloader::activated(Core::IEditor *editor) {
+    postpone();
+    if (not editor)
+        return;
+
+    mHistory.removeAll(editor);
+    mHistory.prepend(editor);
+    sort();
+}
+
+void BufferPreloader::postpone() {
+    mLastActivity.restart();
+    if (mTimer.isActive())
+        mTimer.start(IdleMsec);
+}
+
+void BufferPreloader::schedule() {
+    if (mQueue.isEmpty() or mInFlight or mTimer.isActive())
+        return;
+
+    mTimer.start(qMax<qint64>(0, IdleMsec - mLastActivity.elapsed()));
+}
+
+void BufferPreloader::process() {
+    // The user was active after the timer was started
+    if (mLastActivity.elapsed() < IdleMsec) {
+        schedule();
+        return;
+    }
+
+    QElapsedTimer slice;
+    slice.start();
+
+    while (not mQueue.isEmpty() and mInFlight < MaxInFlight and slice.elapsed() < SliceMsec) {
+        const QPointer<Core::IEditor> editor = mQueue.takeFirst();
+        if (not editor)
+            continue;
+
+        const qint64 bytes = mLoader(editor, [this]() { finished(); });
+        if (bytes < 0)
+            continue;
+
+        ++mInFlight;
+        mLoadedBytes += bytes;
+    }
+
+    report();
+    schedule();
+}
+
+void BufferPreloader::finished() {
+    --mInFlight;
+    ++mLoaded;
+    report();
+
+    // The next batch starts, when the whole current one is loaded
+    schedule();
+}
+
+void BufferPreloader::sort() {
+    mHistory.removeIf([](const auto &editor) { return editor.isNull(); });
+
+    // Editors, that have never been activated, keep their order after the activated ones
+    auto rank = [this](const QPointer<Core::IEditor> &editor) {
+        const int index = mHistory.indexOf(editor);
+        return index < 0 ? mHistory.size() : index;
+    };
+    std::stable_sort(mQueue.begin(), mQueue.end(), [&](const auto &a, const auto &b) {
+        return rank(a) < rank(b);
+    });
+}
+
+void BufferPreloader::report() const {
+    LatencyStats::instance().setPreload(mLoaded, mQueue.size() + mInFlight, mLoadedBytes);
+}
+
+} // namespace Internal
+} // namespace QNVim
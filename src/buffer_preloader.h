@@ -0,0 +1,84 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+#include <functional>
+
+namespace Core {
+class IEditor;
+}
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Mirrors open documents into Neovim buffers while the user is idle, so that
+ * the first switch to a document doesn't wait for its buffer to be created.
+ *
+ * Editors are loaded most recently activated first, in batches limited by time
+ * and by the number of requests in flight, so that keys typed meanwhile don't
+ * queue behind large transfers. Progress is reported to LatencyStats.
+ */
+class BufferPreloader : public QObject {
+    Q_OBJECT
+
+  public:
+    /**
+     * Starts loading the editor and calls @p finished once it's loaded.
+     *
+     * @return size of the sent text, or -1 if the editor doesn't need loading,
+     *         @p finished isn't called then
+     */
+    using Loader = std::function<qint64(Core::IEditor *, std::function<void()> finished)>;
+
+    explicit BufferPreloader(Loader loader, QObject *parent = nullptr);
+
+    /**
+     * Queues the editor, if it isn't queued yet.
+     */
+    void enqueue(Core::IEditor *);
+    void remove(Core::IEditor *);
+    void clear();
+
+    /**
+     * Moves the editor up in the history, the queue is ordered by it.
+     */
+    void activated(Core::IEditor *);
+
+    /**
+     * Postpones loading until the user is idle again.
+     */
+    void postpone();
+
+  private:
+    void schedule();
+    void process();
+    void finished();
+    void sort();
+    void report() const;
+
+    Loader mLoader;
+    QList<QPointer<Core::IEditor>> mQueue;
+    // Most recently activated editors first
+    QList<QPointer<Core::IEditor>> mHistory;
+
+    QTimer mTimer;
+    QElapsedTimer mLastActivity;
+    int mInFlight = 0;
+    int mLoaded = 0;
+    qint64 mLoadedBytes = 0;
+
+    static constexpr int IdleMsec = 500;
+    static constexpr int SliceMsec = 4;
+    static constexpr int MaxInFlight = 4;
+};
+
+} // namespace Internal
+} // namespace QNVim
@@ -0,0 +1,307 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "buffer_registry.h"
+
+#include "latency_stats.h"
+#include "log.h"
+
+#include <algorithm>
+
+namespace QNVim {
+namespace Internal {
+
+namespace {
+
+QList<size_t> hashLines(const QStringList &lines) {
+    QList<size_t> hashes;
+    hashes.reserve(lines.size());
+    for (const QString &line : lines)
+        hashes << qHash(line);
+    return hashes;
+}
+
+} // namespace
+
+BufferRegistry::BufferRegistry() {
+    mClock.start();
+}
+
+bool BufferRegistry::contains(int buffer) const {
+    return mEntries.contains(buffer);
+}
+
+void BufferRegistry::remove(int buffer) {
+    const auto it = mEntries.constFind(buffer);
+    if (it == mEntries.cend())
+        return;
+
+    mResident -= residentBytes(*it);
+    mEntries.erase(it);
+    LatencyStats::instance().setShadow(buffer, 0);
+    reportUnloads();
+}
+
+void BufferRegistry::clear() {
+    for (auto it = mEntries.cbegin(); it != mEntries.cend(); ++it)
+        LatencyStats::instance().setShadow(it.key(), 0);
+
+    mEntries.clear();
+    mResident = 0;
+    reportUnloads();
+}
+
+QString BufferRegistry::type(int buffer) const {
+    const auto it = mEntries.constFind(buffer);
+    return it == mEntries.cend() ? QString() : it->type;
+}
+
+void BufferRegistry::setType(int buffer, const QString &type) {
+    entry(buffer).type = type;
+}
+
+unsigned long long BufferRegistry::changedtick(int buffer) const {
+    const auto it = mEntries.constFind(buffer);
+    return it == mEntries.cend() ? 0 : it->changedtick;
+}
+
+void BufferRegistry::setChangedtick(int buffer, unsigned long long changedtick) {
+    entry(buffer).changedtick = changedtick;
+}
+
+int BufferRegistry::syncedRevision(int buffer) const {
+    const auto it = mEntries.constFind(buffer);
+    return it == mEntries.cend() ? -1 : it->syncedRevision;
+}
+
+void BufferRegistry::setSyncedRevision(int buffer, int revision) {
+    entry(buffer).syncedRevision = revision;
+}
+
+void BufferRegistry::invalidate(int buffer) {
+    if (mEntries.contains(buffer))
+        entry(buffer).syncedRevision = -1;
+}
+
+int BufferRegistry::streamRevision(int buffer) const {
+    const auto it = mEntries.constFind(buffer);
+    return it == mEntries.cend() ? -1 : it->streamRevision;
+}
+
+void BufferRegistry::setStreamRevision(int buffer, int revision) {
+    entry(buffer).streamRevision = revision;
+}
+
+void BufferRegistry::setLines(int buffer, const QStringList &lines) {
+    Entry &shadow = entry(buffer);
+    const qint64 oldBytes = residentBytes(shadow);
+
+    shadow.hasLines = true;
+    shadow.lines = hashLines(lines);
+    resized(buffer, shadow, oldBytes);
+}
+
+void BufferRegistry::replaceLines(int buffer, int first, int last, const QStringList &lines) {
+    const auto it = mEntries.find(buffer);
+    if (it == mEntries.end() or not it->hasLines)
+        return;
+
+    Entry &entry = *it;
+    const qint64 oldBytes = residentBytes(entry);
+    if (last < 0)
+        last = entry.lines.size();
+
+    // The shadow has missed a change, so it can't be trusted anymore
+    if (first < 0 or first > last or last > entry.lines.size()) {
+        qDebug(Buffer) << "Shadow of buffer" << buffer << "doesn't have lines" << first << last;
+        dropLines(buffer);
+        return;
+    }
+
+    const QList<size_t> hashes = hashLines(lines);
+    const int common = qMin(last - first, int(hashes.size()));
+    std::copy(hashes.cbegin(), hashes.cbegin() + common, entry.lines.begin() + first);
+    if (common < hashes.size())
+        entry.lines.insert(first + common, hashes.size() - common, 0);
+    else
+        entry.lines.remove(first + common, last - first - common);
+    std::copy(hashes.cbegin() + common, hashes.cend(), entry.lines.begin() + first + common);
+
+    if (residentBytes(entry) != oldBytes)
+        resized(buffer, entry, oldBytes);
+}
+
+void BufferRegistry::dropLines(int buffer) {
+    const auto it = mEntries.find(buffer);
+    if (it == mEntries.end() or not it->hasLines)
+        return;
+
+    const qint64 oldBytes = residentBytes(*it);
+    it->hasLines = false;
+    it->lines = QList<size_t>();
+    resized(buffer, *it, oldBytes);
+}
+
+bool BufferRegistry::hasLines(int buffer) const {
+    const auto it = mEntries.constFind(buffer);
+    return it != mEntries.cend() and it->hasLines;
+}
+
+std::optional<BufferRegistry::Span> BufferRegistry::diff(int buffer, const QStringList &lines) const {
+    const auto it = mEntries.constFind(buffer);
+    if (it == mEntries.cend() or not it->hasLines)
+        return std::nullopt;
+
+    const QList<size_t> &shadow = it->lines;
+    const QList<size_t> hashes = hashLines(lines);
+    const int size = qMin(shadow.size(), hashes.size());
+
+    int prefix = 0;
+    while (prefix < size and shadow[prefix] == hashes[prefix])
+        ++prefix;
+
+    int suffix = 0;
+    while (suffix < size - prefix and shadow[shadow.size() - 1 - suffix] == hashes[hashes.size() - 1 - suffix])
+        ++suffix;
+
+    return Span{prefix, int(shadow.size()) - suffix, int(hashes.size()) - suffix};
+}
+
+BufferRegistry::Span BufferRegistry::sync(int buffer, const QStringList &lines) {
+    const auto span = diff(buffer, lines);
+    if (not span) {
+        setLines(buffer, lines);
+        return Span{0, -1, int(lines.size())};
+    }
+
+    replaceLines(buffer, span->first, span->last, lines.mid(span->first, span->newLast - span->first));
+    return *span;
+}
+
+bool BufferRegistry::activated(int buffer) {
+    Entry &state = entry(buffer);
+    state.lastUse = ++mUseCounter;
+    state.lastActive = mClock.elapsed();
+
+    const bool loaded = state.loaded;
+    if (loaded) {
+        ++mHits;
+    } else {
+        ++mMisses;
+        state.loaded = true;
+    }
+    reportUnloads();
+    return loaded;
+}
+
+bool BufferRegistry::isLoaded(int buffer) const {
+    const auto it = mEntries.constFind(buffer);
+    return it == mEntries.cend() or it->loaded;
+}
+
+void BufferRegistry::setLoaded(int buffer, bool loaded) {
+    Entry &state = entry(buffer);
+    if (state.loaded == loaded)
+        return;
+
+    state.loaded = loaded;
+    if (not loaded)
+        ++mUnloads;
+    reportUnloads();
+}
+
+QList<int> BufferRegistry::inactiveBuffers(qint64 msec) const {
+    const qint64 now = mClock.elapsed();
+
+    QList<int> buffers;
+    for (auto it = mEntries.cbegin(); it != mEntries.cend(); ++it) {
+        if (it->loaded and now - it->lastActive >= msec and not (it->lastUse and it->lastUse == mUseCounter))
+            buffers << it.key();
+    }
+
+    std::sort(buffers.begin(), buffers.end(), [this](int a, int b) {
+        return mEntries.constFind(a)->lastActive < mEntries.constFind(b)->lastActive;
+    });
+    return buffers;
+}
+
+void BufferRegistry::setBudget(qint64 budget) {
+    mBudget = budget;
+    evict();
+    LatencyStats::instance().setShadowBudget(mBudget, mEvictions);
+}
+
+qint64 BufferRegistry::budget() const {
+    return mBudget;
+}
+
+qint64 BufferRegistry::residentBytes(int buffer) const {
+    const auto it = mEntries.constFind(buffer);
+    return it == mEntries.cend() ? 0 : residentBytes(*it);
+}
+
+qint64 BufferRegistry::residentBytes() const {
+    return mResident;
+}
+
+BufferRegistry::Entry &BufferRegistry::entry(int buffer) {
+    auto it = mEntries.find(buffer);
+    if (it == mEntries.end()) {
+        it = mEntries.insert(buffer, Entry());
+        it->lastActive = mClock.elapsed();
+    }
+    return *it;
+}
+
+qint64 BufferRegistry::residentBytes(const Entry &entry) {
+    return entry.lines.size() * qint64(sizeof(size_t));
+}
+
+void BufferRegistry::resized(int buffer, const Entry &entry, qint64 oldBytes) {
+    mResident += residentBytes(entry) - oldBytes;
+    report(buffer, entry);
+    if (mBudget > 0 and mResident > mBudget)
+        evict();
+}
+
+void BufferRegistry::evict() {
+    if (mBudget <= 0)
+        return;
+
+    while (mResident > mBudget) {
+        // The current buffer is kept, even if it doesn't fit alone
+        auto victim = mEntries.end();
+        for (auto it = mEntries.begin(); it != mEntries.end(); ++it) {
+            if (it->lines.isEmpty() or (it->lastUse and it->lastUse == mUseCounter))
+                continue;
+            if (victim == mEntries.end() or it->lastUse < victim->lastUse)
+                victim = it;
+        }
+
+        if (victim == mEntries.end())
+            break;
+
+        qDebug(Buffer) << "Evicting shadow of buffer" << victim.key() << residentBytes(*victim) << "bytes";
+        mResident -= residentBytes(*victim);
+        victim->hasLines = false;
+        victim->lines = QList<size_t>();
+        ++mEvictions;
+        report(victim.key(), *victim);
+    }
+
+    LatencyStats::instance().setShadowBudget(mBudget, mEvictions);
+}
+
+void BufferRegistry::report(int buffer, const Entry &entry) const {
+    LatencyStats::instance().setShadow(buffer, residentBytes(entry));
+}
+
+void BufferRegistry::reportUnloads() const {
+    int unloaded = 0;
+    for (const Entry &entry : mEntries)
+        unloaded += not entry.loaded;
+    LatencyStats::instance().setUnloads(unloaded, mUnloads, mHits, mMisses);
+}
+
+} // namespace Internal
+} // namespace QNVim
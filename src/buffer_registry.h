@@ -0,0 +1,165 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+
+#include <optional>
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Sync state of every Neovim buffer mirrored into Qt Creator.
+ *
+ * Besides changedticks and revisions, a buffer may have a shadow: hashes of its
+ * lines as Neovim has them. It lets a document, that got out of sync, be sent as
+ * the lines that differ instead of as a whole. Shadows fit into a memory budget,
+ * the ones of least recently activated buffers are evicted when it's exceeded
+ * and are rebuilt with the next full sync of their buffer.
+ *
+ * Buffers, that haven't been activated for a while, may be unloaded in Neovim
+ * to free its memory, the registry tracks them and their activation order.
+ */
+class BufferRegistry {
+  public:
+    BufferRegistry();
+
+    /**
+     * Lines [first, last) of the buffer are replaced with lines [first, newLast)
+     * of the document.
+     */
+    struct Span {
+        int first = 0;
+        int last = 0;
+        int newLast = 0;
+    };
+
+    bool contains(int buffer) const;
+    void remove(int buffer);
+    void clear();
+
+    /**
+     * Buffer type as Neovim reports it, e.g. "acwrite" or "terminal".
+     */
+    QString type(int buffer) const;
+    void setType(int buffer, const QString &);
+
+    /**
+     * Changedtick of the last change received from Neovim, 0 if unknown.
+     */
+    unsigned long long changedtick(int buffer) const;
+    void setChangedtick(int buffer, unsigned long long);
+
+    /**
+     * QTextDocument::revision() matching the Neovim buffer, -1 if none does.
+     */
+    int syncedRevision(int buffer) const;
+    void setSyncedRevision(int buffer, int);
+    void invalidate(int buffer);
+
+    /**
+     * QTextDocument::revision() being streamed to Neovim in large file mode, -1 if none.
+     */
+    int streamRevision(int buffer) const;
+    void setStreamRevision(int buffer, int);
+
+    /**
+     * Makes the lines the shadow of the buffer.
+     */
+    void setLines(int buffer, const QStringList &);
+
+    /**
+     * Replaces lines [first, last) of the shadow, if the buffer has one.
+     * A negative @p last means "until the end of the buffer".
+     */
+    void replaceLines(int buffer, int first, int last, const QStringList &);
+    void dropLines(int buffer);
+    bool hasLines(int buffer) const;
+
+    /**
+     * Range of the shadow, that differs from the lines.
+     *
+     * @return nothing if the buffer has no shadow
+     */
+    std::optional<Span> diff(int buffer, const QStringList &lines) const;
+
+    /**
+     * Range of the buffer, that has to be replaced with the lines to make them match.
+     * The shadow is updated as if it was. Without a shadow the whole buffer is replaced,
+     * its span ends at -1, and the lines become its shadow.
+     */
+    Span sync(int buffer, const QStringList &lines);
+
+    /**
+     * Marks the buffer as the most recently activated one, its shadow is evicted last.
+     * Activating an unloaded buffer counts as a miss and marks it as loaded again.
+     *
+     * @return false if the buffer was unloaded
+     */
+    bool activated(int buffer);
+
+    /**
+     * Whether Neovim has the lines of the buffer, buffers are loaded unless unloaded explicitly.
+     */
+    bool isLoaded(int buffer) const;
+    void setLoaded(int buffer, bool);
+
+    /**
+     * Loaded buffers, that haven't been activated for @p msec, least recently activated first.
+     * The most recently activated buffer is never included.
+     */
+    QList<int> inactiveBuffers(qint64 msec) const;
+
+    /**
+     * Memory for the shadows of all buffers in bytes, 0 or less means unlimited.
+     */
+    void setBudget(qint64);
+    qint64 budget() const;
+
+    qint64 residentBytes(int buffer) const;
+    qint64 residentBytes() const;
+
+  private:
+    struct Entry {
+        QString type;
+        unsigned long long changedtick = 0;
+        int syncedRevision = -1;
+        int streamRevision = -1;
+
+        bool hasLines = false;
+        QList<size_t> lines;
+
+        // Activation order, 0 if never activated
+        quint64 lastUse = 0;
+        // Time of the last activation or of the registration
+        qint64 lastActive = 0;
+        bool loaded = true;
+    };
+
+    Entry &entry(int buffer);
+
+    static qint64 residentBytes(const Entry &);
+    void resized(int buffer, const Entry &, qint64 oldBytes);
+    void evict();
+    void report(int buffer, const Entry &) const;
+    void reportUnloads() const;
+
+    QHash<int, Entry> mEntries;
+    quint64 mUseCounter = 0;
+    qint64 mBudget = 16 * 1024 * 1024;
+    qint64 mResident = 0;
+    int mEvictions = 0;
+
+    QElapsedTimer mClock;
+    int mUnloads = 0;
+    int mHits = 0;
+    int mMisses = 0;
+};
+
+} // namespace Internal
+} // namespace QNVim
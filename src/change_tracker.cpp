@@ -0,0 +1,139 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "change_tracker.h"
+
+#include "text_position.h"
+
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+
+namespace QNVim {
+namespace Internal {
+
+ChangeTracker::ChangeTracker(QTextDocument *document)
+    : mDocument{document} {
+    reset();
+}
+
+bool ChangeTracker::isEmpty() const {
+    return not mPending;
+}
+
+void ChangeTracker::contentsChange(int position, int charsRemoved, int charsAdded) {
+    if (not mDocument)
+        return;
+
+    const int blockCount = mDocument->blockCount();
+    const int lineDelta = blockCount - mBlockCount;
+    mBlockCount = blockCount;
+
+    // Revision stays the same if only formats have changed, e.g. by highlighter
+    if (mDocument->revision() == mRevision)
+        return;
+    mRevision = mDocument->revision();
+
+    if (mWholeDocument)
+        return;
+
+    const int lastPosition = qMin(position + charsAdded, mDocument->characterCount() - 1);
+    const int firstLine = mDocument->findBlock(position).blockNumber();
+    const int newLastLine = mDocument->findBlock(lastPosition).blockNumber() + 1;
+    const int oldLastLine = qMax(firstLine, newLastLine - lineDelta);
+
+    if (not mPending) {
+        mPending = true;
+        mFirstLine = firstLine;
+        mOldLastLine = oldLastLine;
+        mNewLastLine = newLastLine;
+
+        if (charsRemoved == 0 and charsAdded > 0 and lastPosition == position + charsAdded) {
+            mInsertionPosition = position;
+            mInsertionLength = charsAdded;
+            mInsertionLineBreaks = lineDelta;
+        }
+        return;
+    }
+
+    // Merge with the pending range. Lines after the pending range
+    // are shifted relative to Neovim by the difference of its ends.
+    mInsertionPosition = -1;
+
+    const int end = qMax(mNewLastLine, oldLastLine);
+    mOldLastLine = end + (mOldLastLine - mNewLastLine);
+    mNewLastLine = end + (newLastLine - oldLastLine);
+    mFirstLine = qMin(mFirstLine, firstLine);
+}
+
+void ChangeTracker::skipChange() {
+    if (not mDocument)
+        return;
+
+    mBlockCount = mDocument->blockCount();
+    mRevision = mDocument->revision();
+
+    // Pending range can't be mapped to Neovim lines anymore,
+    // but the document contains both changes, so it can be sent as a whole
+    if (mPending)
+        mWholeDocument = true;
+}
+
+void ChangeTracker::reset() {
+    mPending = false;
+    mWholeDocument = false;
+    mInsertionPosition = -1;
+
+    if (mDocument) {
+        mBlockCount = mDocument->blockCount();
+        mRevision = mDocument->revision();
+    }
+}
+
+ChangeTracker::Change ChangeTracker::take() {
+    Change change;
+
+    if (not mPending)
+        return change;
+
+    if (mInsertionPosition >= 0 and not mWholeDocument) {
+        QTextCursor cursor(mDocument);
+        cursor.setPosition(mInsertionPosition);
+        cursor.setPosition(mInsertionPosition + mInsertionLength, QTextCursor::KeepAnchor);
+
+        const QString text = cursor.selectedText().replace(QChar::ParagraphSeparator, '\n');
+        if (text.count('\n') == mInsertionLineBreaks) {
+            const QPoint position = vimPosition(mDocument, mInsertionPosition);
+            change.firstLine = position.y() - 1;
+            change.lastLine = position.y();
+            change.column = position.x() - 1;
+            change.lines = text.split('\n');
+            reset();
+            return change;
+        }
+    }
+
+    int first = mFirstLine;
+    int last = mNewLastLine;
+    change.firstLine = mFirstLine;
+    change.lastLine = mOldLastLine;
+
+    if (mWholeDocument) {
+        first = 0;
+        last = mDocument->blockCount();
+        change.firstLine = 0;
+        change.lastLine = -1;
+    }
+
+    QTextBlock block = mDocument->findBlockByNumber(first);
+    for (int line = first; line < last and block.isValid(); ++line) {
+        change.lines << block.text();
+        block = block.next();
+    }
+
+    reset();
+    return change;
+}
+
+} // namespace Internal
+} // namespace QNVim
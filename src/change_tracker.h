@@ -0,0 +1,72 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QStringList>
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Accumulates QTextDocument::contentsChange notifications of one document
+ * into a single line range, that can be sent to Neovim in one request.
+ */
+class ChangeTracker {
+  public:
+    /**
+     * Replacement of lines [firstLine, lastLine) as Neovim knows them.
+     * If column is not negative, the change is an insertion of lines
+     * at the given byte column of firstLine instead.
+     */
+    struct Change {
+        int firstLine = 0;
+        int lastLine = 0;
+        int column = -1;
+        QStringList lines;
+    };
+
+    ChangeTracker() = default;
+    explicit ChangeTracker(QTextDocument *);
+
+    bool isEmpty() const;
+
+    /**
+     * Records a change made in Qt Creator, that should be sent to Neovim.
+     */
+    void contentsChange(int position, int charsRemoved, int charsAdded);
+
+    /**
+     * Accounts for a change, that Neovim already knows about.
+     */
+    void skipChange();
+
+    /**
+     * Forgets everything recorded so far, e.g. after the whole document was sent.
+     */
+    void reset();
+
+    Change take();
+
+  private:
+    QTextDocument *mDocument = nullptr;
+    int mBlockCount = 0;
+    int mRevision = 0;
+
+    bool mPending = false;
+    bool mWholeDocument = false;
+    int mFirstLine = 0;
+    int mOldLastLine = 0;
+    int mNewLastLine = 0;
+
+    int mInsertionPosition = -1;
+    int mInsertionLength = 0;
+    int mInsertionLineBreaks = 0;
+};
+
+} // namespace Internal
+} // namespace QNVim
@@ -0,0 +1,170 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "command_line.h"
+
+#include <QEvent>
+
+namespace QNVim {
+namespace Internal {
+
+CommandLine::CommandLine(QWidget *parent)
+    : QPlainTextEdit(parent) {
+    document()->setDocumentMargin(0);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setLineWrapMode(QPlainTextEdit::NoWrap);
+    setMinimumWidth(200);
+    setFocusPolicy(Qt::StrongFocus);
+}
+
+void CommandLine::showCmdline(const QString &firstc, const QString &prompt, int indent, const QString &content, int pos) {
+    if (not mCmdlineVisible or firstc != mFirstc or prompt != mPrompt or indent != mIndent or content != mContent) {
+        mCmdlineVisible = true;
+        mFirstc = firstc;
+        mPrompt = prompt;
+        mIndent = indent;
+        mContent = content;
+        mTextDirty = true;
+    }
+
+    setCmdlinePos(pos);
+}
+
+void CommandLine::setCmdlinePos(int pos) {
+    if (pos == mPos)
+        return;
+
+    mPos = pos;
+    mCursorDirty = true;
+}
+
+void CommandLine::hideCmdline() {
+    if (not mCmdlineVisible)
+        return;
+
+    mCmdlineVisible = false;
+    mTextDirty = true;
+}
+
+bool CommandLine::isCmdlineVisible() const {
+    return mCmdlineVisible;
+}
+
+void CommandLine::setMessage(const QString &message) {
+    if (message == mMessage)
+        return;
+
+    mMessage = message;
+    if (not mCmdlineVisible)
+        mTextDirty = true;
+}
+
+void CommandLine::setMode(const QByteArray &mode) {
+    if (mode == mMode)
+        return;
+
+    mMode = mode;
+    mCursorDirty = true;
+}
+
+void CommandLine::flush() {
+    if (mTextDirty) {
+        mTextDirty = false;
+
+        const QString text = mCmdlineVisible ? cmdlineText() : mMessage;
+        if (text != mText) {
+            mText = text;
+            setPlainText(mText);
+            setToolTip(mText);
+            mCursorDirty = true;
+        }
+
+        // Size depends on whether the command line is visible, even if the text is the same
+        updateSize(mText);
+    }
+
+    if (mCursorDirty and mCmdlineVisible) {
+        QTextCursor cursor = textCursor();
+        const int position = qMin(cmdlineCursorPosition(), document()->characterCount() - 1);
+        if (cursor.position() != position) {
+            cursor.setPosition(position);
+            setTextCursor(cursor);
+        }
+
+        if (mMode == "cmdline_normal") {
+            if (cursorWidth() != 1)
+                setCursorWidth(1);
+        } else if (mMode == "cmdline_insert") {
+            if (cursorWidth() != 11)
+                setCursorWidth(11);
+        }
+    }
+    mCursorDirty = false;
+}
+
+void CommandLine::changeEvent(QEvent *event) {
+    if (event->type() == QEvent::FontChange) {
+        mLineSpacing = 0;
+        mHeight = -1;
+        mTextDirty = true;
+    }
+
+    QPlainTextEdit::changeEvent(event);
+}
+
+QString CommandLine::cmdlineText() const {
+    return mFirstc + mPrompt + QString(mIndent, ' ') + mContent;
+}
+
+int CommandLine::cmdlineCursorPosition() const {
+    return mFirstc.length() + mPrompt.length() + mIndent + mPos;
+}
+
+void CommandLine::updateSize(const QString &text) {
+    const QFontMetrics fm = fontMetrics();
+    if (not mLineSpacing)
+        mLineSpacing = fm.height();
+
+    // Messages are shown in a single line, they are available in full in the tool tip
+    if (not mCmdlineVisible) {
+        setHeight(mLineSpacing);
+        return;
+    }
+
+    int lines = 1;
+    int width = 0;
+    int start = 0;
+    for (int i = 0; i <= text.size(); ++i) {
+        if (i < text.size() and text[i] != '\n' and text[i] != '\r')
+            continue;
+
+        width = qMax(width, fm.horizontalAdvance(text.mid(start, i - start)));
+        start = i + 1;
+        if (i < text.size())
+            ++lines;
+    }
+
+    const int minimumWidth = qMax(200, qMin(width + 10, 400));
+    if (this->minimumWidth() != minimumWidth)
+        setMinimumWidth(minimumWidth);
+
+    setHeight(lines * mLineSpacing);
+}
+
+void CommandLine::setHeight(int textHeight) {
+    const int height = qMax(25, qMin(textHeight + 4, 400));
+    if (height == mHeight)
+        return;
+
+    mHeight = height;
+    setMinimumHeight(height);
+
+    // Status bar doesn't grow with its widgets, so its containers are resized too
+    QWidget *widget = parentWidget();
+    for (int i = 0; i < 3 and widget; ++i, widget = widget->parentWidget())
+        widget->setFixedHeight(height);
+}
+
+} // namespace Internal
+} // namespace QNVim
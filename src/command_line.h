@@ -0,0 +1,66 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QPlainTextEdit>
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Status bar widget showing Neovim's command line or, when it's hidden, the last message.
+ *
+ * Redraw events only update the model, flush() applies it to the widget at the end
+ * of a batch. Text, metrics and sizes are cached, so that a flush without changes,
+ * e.g. after a cursor move, doesn't touch the widget at all.
+ */
+class CommandLine : public QPlainTextEdit {
+    Q_OBJECT
+
+  public:
+    explicit CommandLine(QWidget *parent = nullptr);
+
+    void showCmdline(const QString &firstc, const QString &prompt, int indent, const QString &content, int pos);
+    void setCmdlinePos(int pos);
+    void hideCmdline();
+    bool isCmdlineVisible() const;
+
+    void setMessage(const QString &message);
+    void setMode(const QByteArray &mode);
+
+    /**
+     * Applies changes made since the last flush.
+     */
+    void flush();
+
+  protected:
+    void changeEvent(QEvent *event) override;
+
+  private:
+    QString cmdlineText() const;
+    int cmdlineCursorPosition() const;
+    void updateSize(const QString &text);
+    void setHeight(int textHeight);
+
+    // Model
+    bool mCmdlineVisible = false;
+    QString mFirstc;
+    QString mPrompt;
+    int mIndent = 0;
+    QString mContent;
+    int mPos = 0;
+    QString mMessage;
+    QByteArray mMode;
+
+    bool mTextDirty = false;
+    bool mCursorDirty = false;
+
+    // What is applied to the widget
+    QString mText;
+    int mHeight = -1;
+    int mLineSpacing = 0;
+};
+
+} // namespace Internal
+} // namespace QNVim
@@ -0,0 +1,113 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "document_sync.h"
+
+#include "line_differ.h"
+#include "log.h"
+
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+
+namespace QNVim {
+namespace Internal {
+
+bool replaceLines(QTextDocument *document, int first, int last, const QStringList &lines) {
+    const int blockCount = document->blockCount();
+    first = qBound(0, first, blockCount);
+    if (last < 0 or last > blockCount)
+        last = blockCount;
+    last = qMax(first, last);
+
+    // Skip the lines that are already up to date on both ends of the range
+    const int common = qMin(last - first, int(lines.size()));
+
+    int prefix = 0;
+    QTextBlock block = document->findBlockByNumber(first);
+    while (prefix < common and block.text() == lines[prefix]) {
+        ++prefix;
+        block = block.next();
+    }
+
+    int suffix = 0;
+    block = document->findBlockByNumber(last - 1);
+    while (suffix < common - prefix and block.text() == lines[lines.size() - 1 - suffix]) {
+        ++suffix;
+        block = block.previous();
+    }
+
+    const int from = first + prefix;
+    const int to = last - suffix;
+    const QStringList replacement = lines.mid(prefix, lines.size() - prefix - suffix);
+
+    if (from == to and replacement.isEmpty())
+        return false;
+
+    QTextCursor cursor(document);
+    cursor.beginEditBlock();
+
+    if (from == to) {
+        const QString text = replacement.join('\n');
+        if (from < blockCount) {
+            cursor.setPosition(document->findBlockByNumber(from).position());
+            cursor.insertText(text + '\n');
+        } else {
+            cursor.movePosition(QTextCursor::End);
+            cursor.insertText('\n' + text);
+        }
+    } else if (replacement.isEmpty()) {
+        if (to < blockCount) {
+            cursor.setPosition(document->findBlockByNumber(from).position());
+            cursor.setPosition(document->findBlockByNumber(to).position(), QTextCursor::KeepAnchor);
+        } else if (from > 0) {
+            // Removing the trailing lines also removes the line break in front of them
+            const QTextBlock previous = document->findBlockByNumber(from - 1);
+            cursor.setPosition(previous.position() + previous.length() - 1);
+            cursor.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
+        } else {
+            cursor.select(QTextCursor::Document);
+        }
+        cursor.removeSelectedText();
+    } else {
+        const QTextBlock lastBlock = document->findBlockByNumber(to - 1);
+        cursor.setPosition(document->findBlockByNumber(from).position());
+        cursor.setPosition(lastBlock.position() + lastBlock.length() - 1, QTextCursor::KeepAnchor);
+        cursor.insertText(replacement.join('\n'));
+    }
+
+    cursor.endEditBlock();
+    return true;
+}
+
+bool replaceText(QTextDocument *document, const QStringList &lines) {
+    QStringList oldLines;
+    oldLines.reserve(document->blockCount());
+    for (QTextBlock block = document->firstBlock(); block.isValid(); block = block.next())
+        oldLines << block.text();
+
+    LineDiffer differ;
+    const auto edits = differ.diff(oldLines, lines);
+    if (differ.isTimedOut())
+        qDebug(Buffer) << "Resync diff ran out of time, replacing the changed lines as a whole";
+
+    if (edits.isEmpty())
+        return false;
+
+    QTextCursor cursor(document);
+    cursor.beginEditBlock();
+
+    // Bottom up, so that positions of the lines above stay valid
+    for (auto it = edits.crbegin(); it != edits.crend(); ++it) {
+        const int position = document->findBlockByNumber(it->line).position() + it->offset;
+        cursor.setPosition(position);
+        cursor.setPosition(position + it->removed, QTextCursor::KeepAnchor);
+        cursor.insertText(it->text);
+    }
+
+    cursor.endEditBlock();
+    return true;
+}
+
+} // namespace Internal
+} // namespace QNVim
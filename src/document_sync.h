@@ -0,0 +1,34 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QStringList>
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Replaces lines [first, last) of the document with @p lines, the same way
+ * nvim_buf_lines_event describes a change. Only the lines that actually differ
+ * are touched, so an event echoing the current contents is a no-op.
+ * A negative @p last means "until the end of the document".
+ *
+ * @return true if the document was modified
+ */
+bool replaceLines(QTextDocument *document, int first, int last, const QStringList &lines);
+
+/**
+ * Makes the document consist of @p lines, editing only the differing parts.
+ * Used as a fallback when the incremental stream can't be trusted, see LineDiffer.
+ *
+ * @return true if the document was modified
+ */
+bool replaceText(QTextDocument *document, const QStringList &lines);
+
+} // namespace Internal
+} // namespace QNVim
@@ -0,0 +1,247 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "latency_stats.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QTextStream>
+#include <QtAlgorithms>
+
+namespace QNVim {
+namespace Internal {
+
+void Histogram::record(qint64 value) {
+    value = qMax<qint64>(value, 0);
+
+    ++mCounts[indexOf(value)];
+    mMin = mCount ? qMin(mMin, value) : value;
+    mMax = qMax(mMax, value);
+    mSum += value;
+    ++mCount;
+}
+
+void Histogram::reset() {
+    mCounts.fill(0);
+    mCount = 0;
+    mMin = 0;
+    mMax = 0;
+    mSum = 0;
+}
+
+qint64 Histogram::count() const {
+    return mCount;
+}
+
+qint64 Histogram::min() const {
+    return mMin;
+}
+
+qint64 Histogram::max() const {
+    return mMax;
+}
+
+double Histogram::mean() const {
+    return mCount ? mSum / mCount : 0;
+}
+
+qint64 Histogram::percentile(double percent) const {
+    if (not mCount)
+        return 0;
+
+    const qint64 target = qMax<qint64>(1, qint64(qBound(0.0, percent, 100.0) / 100 * mCount + 0.5));
+
+    qint64 seen = 0;
+    for (int i = 0; i < BucketCount; ++i) {
+        seen += mCounts[i];
+        if (seen >= target)
+            return qMin(highestValueAt(i), mMax);
+    }
+
+    return mMax;
+}
+
+int Histogram::indexOf(quint64 value) {
+    // Values below 2 * SubBucketHalf have a bucket of their own
+    if (value < 2 * SubBucketHalf)
+        return int(value);
+
+    const int exponent = 63 - qCountLeadingZeroBits(value);
+    const int shift = exponent - SubBucketBits + 1;
+    return shift * SubBucketHalf + int(value >> shift);
+}
+
+qint64 Histogram::highestValueAt(int index) {
+    if (index < 2 * SubBucketHalf)
+        return index;
+
+    const int shift = index / SubBucketHalf - 1;
+    const qint64 subBucket = index - shift * SubBucketHalf;
+    return ((subBucket + 1) << shift) - 1;
+}
+
+LatencyStats &LatencyStats::instance() {
+    static LatencyStats stats;
+    return stats;
+}
+
+LatencyStats::LatencyStats() {
+    mClock.start();
+}
+
+qint64 LatencyStats::now() {
+    return instance().mClock.nsecsElapsed();
+}
+
+void LatencyStats::record(Metric metric, qint64 value) {
+    mHistograms[metric].record(value);
+}
+
+void LatencyStats::recordSince(Metric metric, qint64 timestamp) {
+    mHistograms[metric].record((now() - timestamp) / 1000);
+}
+
+void LatencyStats::reset() {
+    for (auto &histogram : mHistograms)
+        histogram.reset();
+}
+
+void LatencyStats::beginStartup() {
+    mStartupBegin = now();
+    mStartup.fill(-1);
+}
+
+void LatencyStats::markStartup(StartupPhase phase) {
+    if (mStartupBegin < 0 or mStartup[phase] >= 0)
+        return;
+
+    mStartup[phase] = now();
+}
+
+void LatencyStats::setPreload(int loaded, int pending, qint64 bytes) {
+    mPreloaded = loaded;
+    mPreloadPending = pending;
+    mPreloadedBytes = bytes;
+}
+
+void LatencyStats::setShadow(int buffer, qint64 bytes) {
+    if (bytes > 0)
+        mShadows[buffer] = bytes;
+    else
+        mShadows.remove(buffer);
+}
+
+void LatencyStats::setShadowBudget(qint64 budget, int evictions) {
+    mShadowBudget = budget;
+    mShadowEvictions = evictions;
+}
+
+void LatencyStats::setUnloads(int unloaded, int unloads, int hits, int misses) {
+    mUnloaded = unloaded;
+    mUnloads = unloads;
+    mUnloadHits = hits;
+    mUnloadMisses = misses;
+}
+
+void LatencyStats::setNeovimMemory(qint64 bytes) {
+    mNeovimMemory = bytes;
+}
+
+const Histogram &LatencyStats::histogram(Metric metric) const {
+    return mHistograms[metric];
+}
+
+QString LatencyStats::report() const {
+    static const char *const names[MetricCount] = {
+        "Key press to state (us)",
+        "Input queue (us)",
+        "RPC round-trip (us)",
+        "Redraw (us)",
+        "Sync flush (us)",
+        "Sync size (bytes)",
+        "Buffer open (us)",
+    };
+
+    QString result;
+    QTextStream stream(&result);
+
+    stream << qSetFieldWidth(26) << Qt::left << "Metric" << qSetFieldWidth(10) << Qt::right
+           << "count" << "min" << "p50" << "p90" << "p99" << "p99.9" << "max" << "mean"
+           << qSetFieldWidth(0) << '\n';
+
+    for (int i = 0; i < MetricCount; ++i) {
+        const Histogram &h = mHistograms[i];
+        stream << qSetFieldWidth(26) << Qt::left << names[i] << qSetFieldWidth(10) << Qt::right
+               << h.count() << h.min() << h.percentile(50) << h.percentile(90)
+               << h.percentile(99) << h.percentile(99.9) << h.max() << qint64(h.mean())
+               << qSetFieldWidth(0) << '\n';
+    }
+
+    stream << "\nPreloaded buffers: " << mPreloaded << " (" << mPreloadedBytes / 1024 << " KiB of text), "
+           << mPreloadPending << " pending\n";
+
+    qint64 resident = 0;
+    for (const qint64 bytes : mShadows)
+        resident += bytes;
+    stream << "Buffer shadows: " << resident / 1024 << " KiB of ";
+    if (mShadowBudget > 0)
+        stream << mShadowBudget / 1024 << " KiB";
+    else
+        stream << "unlimited";
+    stream << " budget, " << mShadowEvictions << " evicted\n";
+    for (auto it = mShadows.cbegin(); it != mShadows.cend(); ++it)
+        stream << "  buffer " << it.key() << ": " << it.value() / 1024 << " KiB\n";
+
+    stream << "Unloaded buffers: " << mUnloaded << " (" << mUnloads << " unloads), "
+           << mUnloadHits << " hits, " << mUnloadMisses << " misses\n";
+    stream << "Neovim memory: ";
+    if (mNeovimMemory < 0)
+        stream << "unknown\n";
+    else
+        stream << mNeovimMemory / (1024 * 1024) << " MiB\n";
+
+    if (mStartupBegin < 0)
+        return result;
+
+    static const char *const phases[StartupPhaseCount] = {
+        "Spawn",
+        "Ready",
+        "UI attach",
+        "First buffer synced",
+    };
+
+    stream << '\n' << qSetFieldWidth(26) << Qt::left << "Startup phase" << qSetFieldWidth(10) << Qt::right
+           << "phase" << "total" << qSetFieldWidth(0) << " (us)\n";
+
+    qint64 previous = mStartupBegin;
+    for (int i = 0; i < StartupPhaseCount; ++i) {
+        stream << qSetFieldWidth(26) << Qt::left << phases[i] << qSetFieldWidth(10) << Qt::right;
+        if (mStartup[i] < 0) {
+            stream << "-" << "-";
+        } else {
+            stream << (mStartup[i] - previous) / 1000 << (mStartup[i] - mStartupBegin) / 1000;
+            previous = mStartup[i];
+        }
+        stream << qSetFieldWidth(0) << '\n';
+    }
+
+    return result;
+}
+
+bool LatencyStats::dump(const QString &fileName, QString *errorString) const {
+    QFile file(fileName);
+    if (not file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    QTextStream stream(&file);
+    stream << "# QNVim latency statistics, " << QDateTime::currentDateTime().toString(Qt::ISODate) << '\n'
+           << report();
+
+    return true;
+}
+
+} // namespace Internal
+} // namespace QNVim
@@ -0,0 +1,157 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QString>
+
+#include <array>
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Log-linear histogram in the spirit of HdrHistogram.
+ *
+ * Every power of two range is split into the same number of linear sub-buckets,
+ * so recording is a couple of bit operations and the relative error of reported
+ * values stays within 1/16 for any magnitude.
+ */
+class Histogram {
+  public:
+    void record(qint64 value);
+    void reset();
+
+    qint64 count() const;
+    qint64 min() const;
+    qint64 max() const;
+    double mean() const;
+
+    /**
+     * Highest value of the bucket, that contains the given percentile.
+     */
+    qint64 percentile(double) const;
+
+  private:
+    static constexpr int SubBucketBits = 5;
+    static constexpr int SubBucketHalf = 1 << (SubBucketBits - 1);
+    static constexpr int BucketCount = (64 - SubBucketBits + 1) * SubBucketHalf;
+
+    static int indexOf(quint64 value);
+    static qint64 highestValueAt(int index);
+
+    std::array<qint64, BucketCount> mCounts{};
+    qint64 mCount = 0;
+    qint64 mMin = 0;
+    qint64 mMax = 0;
+    double mSum = 0;
+};
+
+/**
+ * Always-on latency instrumentation of the plugin.
+ *
+ * Statistics outlive QNVimCore, so that they survive toggling the plugin.
+ */
+class LatencyStats {
+  public:
+    enum Metric {
+        KeyToState, ///< Key press received in Qt to Neovim's resulting state applied to the editor, µs
+        InputQueue, ///< Key press received in Qt to nvim_input sent, µs
+        RoundTrip,  ///< Request sent to Neovim to its response received, µs
+        Redraw,     ///< Handling of one redraw notification, µs
+        SyncFlush,  ///< Applying Neovim text or cursor to the editor, µs
+        SyncBytes,  ///< Text transferred by one buffer sync in any direction, bytes
+        BufferOpen, ///< Editor opened in Qt Creator to its buffer created and synced in Neovim, µs
+        MetricCount
+    };
+
+    enum StartupPhase {
+        Spawn,     ///< Neovim process requested and its runtime installed
+        Ready,     ///< Neovim answered the API info request
+        UiAttach,  ///< nvim_ui_attach finished, startup files are sourced by then
+        FirstSync, ///< First buffer synced between Qt Creator and Neovim
+        StartupPhaseCount
+    };
+
+    static LatencyStats &instance();
+
+    /**
+     * Monotonic timestamp in nanoseconds for measuring intervals.
+     */
+    static qint64 now();
+
+    void record(Metric, qint64 value);
+
+    /**
+     * Records interval from the timestamp till now in microseconds.
+     */
+    void recordSince(Metric, qint64 timestamp);
+
+    void reset();
+
+    /**
+     * Starts a new startup profile, phases are timed from this point. Unlike
+     * the histograms, the profile isn't cleared by reset().
+     */
+    void beginStartup();
+
+    /**
+     * Records the time of the phase, if it isn't recorded yet.
+     */
+    void markStartup(StartupPhase);
+
+    /**
+     * Progress of BufferPreloader: loaded buffers with the size of their text and pending ones.
+     */
+    void setPreload(int loaded, int pending, qint64 bytes);
+
+    /**
+     * Memory used by the shadow of a buffer in BufferRegistry, 0 if it has none.
+     */
+    void setShadow(int buffer, qint64 bytes);
+    void setShadowBudget(qint64 budget, int evictions);
+
+    /**
+     * Buffers unloaded in Neovim now and in total, activations of loaded and unloaded buffers.
+     */
+    void setUnloads(int unloaded, int unloads, int hits, int misses);
+
+    /**
+     * Resident set size of the Neovim process in bytes.
+     */
+    void setNeovimMemory(qint64 bytes);
+
+    const Histogram &histogram(Metric) const;
+
+    QString report() const;
+    bool dump(const QString &fileName, QString *errorString = nullptr) const;
+
+  private:
+    LatencyStats();
+
+    QElapsedTimer mClock;
+    std::array<Histogram, MetricCount> mHistograms;
+
+    // Timestamps of the startup phases, -1 if not reached
+    qint64 mStartupBegin = -1;
+    std::array<qint64, StartupPhaseCount> mStartup{};
+
+    int mPreloaded = 0;
+    int mPreloadPending = 0;
+    qint64 mPreloadedBytes = 0;
+
+    QMap<int, qint64> mShadows;
+    qint64 mShadowBudget = 0;
+    int mShadowEvictions = 0;
+
+    int mUnloaded = 0;
+    int mUnloads = 0;
+    int mUnloadHits = 0;
+    int mUnloadMisses = 0;
+    qint64 mNeovimMemory = -1;
+};
+
+} // namespace Internal
+} // namespace QNVim
@@ -0,0 +1,242 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "line_differ.h"
+
+#include <QHashFunctions>
+
+namespace QNVim {
+namespace Internal {
+
+namespace {
+
+// qHash of strings is vectorized with AES-NI, where the CPU supports it
+QList<size_t> hashLines(const QStringList &lines, int first, int last) {
+    QList<size_t> hashes;
+    hashes.reserve(last - first);
+    for (int i = first; i < last; ++i)
+        hashes << qHash(lines[i]);
+    return hashes;
+}
+
+int commonPrefix(QStringView a, QStringView b) {
+    const int size = qMin(a.size(), b.size());
+    int prefix = 0;
+    while (prefix < size and a[prefix] == b[prefix])
+        ++prefix;
+    return prefix;
+}
+
+int commonSuffix(QStringView a, QStringView b, int prefix) {
+    const int size = qMin(a.size(), b.size()) - prefix;
+    int suffix = 0;
+    while (suffix < size and a[a.size() - 1 - suffix] == b[b.size() - 1 - suffix])
+        ++suffix;
+    return suffix;
+}
+
+// Characters of the lines including the line breaks between them
+int length(const QStringList &lines, int first, int last) {
+    int length = qMax(0, last - first - 1);
+    for (int i = first; i < last; ++i)
+        length += lines[i].size();
+    return length;
+}
+
+} // namespace
+
+LineDiffer::LineDiffer(int budgetMsec)
+    : mBudget{qint64(budgetMsec) * 1000000} {
+}
+
+QList<LineDiffer::Edit> LineDiffer::diff(const QStringList &oldLines, const QStringList &newLines) {
+    mTimer.start();
+    mTimedOut = false;
+    mOld = oldLines;
+    mNew = newLines;
+
+    const int oldCount = mOld.size();
+    const int newCount = mNew.size();
+    const int common = qMin(oldCount, newCount);
+
+    // Most of the lines are equal in a resync, so the ends are compared right away
+    int prefix = 0;
+    while (prefix < common and mOld[prefix] == mNew[prefix])
+        ++prefix;
+
+    int suffix = 0;
+    while (suffix < common - prefix and mOld[oldCount - 1 - suffix] == mNew[newCount - 1 - suffix])
+        ++suffix;
+
+    QList<Edit> edits;
+    if (prefix == oldCount and prefix == newCount)
+        return edits;
+
+    mOldHashes = hashLines(mOld, prefix, oldCount - suffix);
+    mNewHashes = hashLines(mNew, prefix, newCount - suffix);
+
+    const auto hunks = diffLines(prefix, oldCount - suffix, newCount - suffix);
+    for (const Hunk &hunk : hunks)
+        refine(hunk, edits);
+
+    mOld.clear();
+    mNew.clear();
+    mOldHashes.clear();
+    mNewHashes.clear();
+    return edits;
+}
+
+bool LineDiffer::isTimedOut() const {
+    return mTimedOut;
+}
+
+QList<LineDiffer::Hunk> LineDiffer::diffLines(int first, int oldLast, int newLast) {
+    const int n = oldLast - first;
+    const int m = newLast - first;
+    if (n == 0 or m == 0)
+        return {Hunk{first, oldLast, first, newLast}};
+
+    auto equal = [&](int x, int y) {
+        return mOldHashes[x] == mNewHashes[y] and mOld[first + x] == mNew[first + y];
+    };
+
+    // Myers' greedy algorithm, v[k] is the furthest x reached on diagonal k = x - y.
+    // Every round stores v of the previous one for the backtracking.
+    const int limit = qMin(n + m, MaxDistance);
+    const int offset = limit + 1;
+    QList<int> v(2 * limit + 3, 0);
+    QList<QList<int>> trace;
+
+    int distance = -1;
+    for (int d = 0; d <= limit and distance < 0; ++d) {
+        if (isOverBudget())
+            break;
+
+        trace << v.mid(offset - d - 1, 2 * d + 3);
+        for (int k = -d; k <= d; k += 2) {
+            int x = (k == -d or (k != d and v[offset + k - 1] < v[offset + k + 1])) ? v[offset + k + 1]
+                                                                                    : v[offset + k - 1] + 1;
+            int y = x - k;
+            while (x < n and y < m and equal(x, y)) {
+                ++x;
+                ++y;
+            }
+
+            v[offset + k] = x;
+            if (x >= n and y >= m) {
+                distance = d;
+                break;
+            }
+        }
+    }
+
+    if (distance < 0) {
+        mTimedOut = true;
+        return {Hunk{first, oldLast, first, newLast}};
+    }
+
+    // Equal lines from the end, the gaps between them are the hunks
+    QList<QPair<int, int>> matches;
+    int x = n;
+    int y = m;
+    for (int d = distance; d >= 0; --d) {
+        const QList<int> &previous = trace[d];
+        auto at = [&](int k) { return previous[k + d + 1]; };
+
+        const int k = x - y;
+        const int previousK = (k == -d or (k != d and at(k - 1) < at(k + 1))) ? k + 1 : k - 1;
+        const int previousX = at(previousK);
+        const int previousY = previousX - previousK;
+
+        while (x > previousX and y > previousY) {
+            --x;
+            --y;
+            matches << qMakePair(x, y);
+        }
+
+        x = previousX;
+        y = previousY;
+    }
+
+    QList<Hunk> hunks;
+    int oldLine = 0;
+    int newLine = 0;
+    for (auto it = matches.crbegin(); it != matches.crend(); ++it) {
+        if (it->first > oldLine or it->second > newLine)
+            hunks << Hunk{first + oldLine, first + it->first, first + newLine, first + it->second};
+        oldLine = it->first + 1;
+        newLine = it->second + 1;
+    }
+    if (oldLine < n or newLine < m)
+        hunks << Hunk{first + oldLine, oldLast, first + newLine, newLast};
+
+    return hunks;
+}
+
+void LineDiffer::refine(const Hunk &hunk, QList<Edit> &edits) {
+    const int oldCount = mOld.size();
+    auto newText = [&]() {
+        return mNew.mid(hunk.newFirst, hunk.newLast - hunk.newFirst).join('\n');
+    };
+
+    if (hunk.oldFirst == hunk.oldLast) {
+        const QString text = newText();
+        if (hunk.oldFirst < oldCount)
+            edits << Edit{hunk.oldFirst, 0, 0, text + '\n'};
+        else if (oldCount > 0)
+            edits << Edit{oldCount - 1, int(mOld[oldCount - 1].size()), 0, '\n' + text};
+        else
+            edits << Edit{0, 0, 0, text};
+        return;
+    }
+
+    if (hunk.newFirst == hunk.newLast) {
+        const int removed = length(mOld, hunk.oldFirst, hunk.oldLast);
+        if (hunk.oldLast < oldCount) {
+            edits << Edit{hunk.oldFirst, 0, removed + 1, QString()};
+        } else if (hunk.oldFirst > 0) {
+            // Removing the trailing lines also removes the line break in front of them
+            const int line = hunk.oldFirst - 1;
+            edits << Edit{line, int(mOld[line].size()), removed + 1, QString()};
+        } else {
+            edits << Edit{0, 0, removed, QString()};
+        }
+        return;
+    }
+
+    // Lines of equal hunks are usually edited in place, so they are refined one by one
+    if (not isOverBudget() and hunk.oldLast - hunk.oldFirst == hunk.newLast - hunk.newFirst) {
+        for (int i = 0; i < hunk.oldLast - hunk.oldFirst; ++i) {
+            const QString &a = mOld[hunk.oldFirst + i];
+            const QString &b = mNew[hunk.newFirst + i];
+            if (a == b)
+                continue;
+
+            const int prefix = commonPrefix(a, b);
+            const int suffix = commonSuffix(a, b, prefix);
+            edits << Edit{hunk.oldFirst + i, prefix, int(a.size()) - prefix - suffix,
+                          b.mid(prefix, b.size() - prefix - suffix)};
+        }
+        return;
+    }
+
+    const QString text = newText();
+    if (isOverBudget()) {
+        mTimedOut = true;
+        edits << Edit{hunk.oldFirst, 0, length(mOld, hunk.oldFirst, hunk.oldLast), text};
+        return;
+    }
+
+    const QString oldText = mOld.mid(hunk.oldFirst, hunk.oldLast - hunk.oldFirst).join('\n');
+    const int prefix = commonPrefix(oldText, text);
+    const int suffix = commonSuffix(oldText, text, prefix);
+    edits << Edit{hunk.oldFirst, prefix, int(oldText.size()) - prefix - suffix,
+                  text.mid(prefix, text.size() - prefix - suffix)};
+}
+
+bool LineDiffer::isOverBudget() const {
+    return mTimer.nsecsElapsed() > mBudget;
+}
+
+} // namespace Internal
+} // namespace QNVim
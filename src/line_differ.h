@@ -0,0 +1,80 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QStringList>
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Diff of two versions of a document for a full resync, when the incremental
+ * stream of changes can't be trusted.
+ *
+ * Lines are compared by their hashes, the common prefix and suffix are skipped
+ * and the rest is diffed line by line with Myers' algorithm. Only the changed
+ * lines are refined to characters. Once the time budget or the edit distance
+ * limit is exceeded, the changed span is replaced as a whole instead, so that
+ * a resync never freezes the editor.
+ */
+class LineDiffer {
+  public:
+    /**
+     * Replacement of @p removed characters starting at @p offset from the
+     * beginning of @p line of the old text. Line breaks count as one character,
+     * the same way QTextDocument counts them, so an edit may span several lines.
+     */
+    struct Edit {
+        int line = 0;
+        int offset = 0;
+        int removed = 0;
+        QString text;
+    };
+
+    explicit LineDiffer(int budgetMsec = DefaultBudgetMsec);
+
+    /**
+     * Edits turning @p oldLines into @p newLines, in document order.
+     */
+    QList<Edit> diff(const QStringList &oldLines, const QStringList &newLines);
+
+    /**
+     * Whether the last diff ran out of its budget and replaced a span as a whole.
+     */
+    bool isTimedOut() const;
+
+    static constexpr int DefaultBudgetMsec = 20;
+
+  private:
+    /**
+     * Lines [oldFirst, oldLast) replaced with lines [newFirst, newLast).
+     */
+    struct Hunk {
+        int oldFirst = 0;
+        int oldLast = 0;
+        int newFirst = 0;
+        int newLast = 0;
+    };
+
+    QList<Hunk> diffLines(int first, int oldLast, int newLast);
+    void refine(const Hunk &, QList<Edit> &);
+    bool isOverBudget() const;
+
+    QStringList mOld;
+    QStringList mNew;
+    QList<size_t> mOldHashes;
+    QList<size_t> mNewHashes;
+
+    qint64 mBudget;
+    QElapsedTimer mTimer;
+    bool mTimedOut = false;
+
+    // Myers' trace takes O(D^2) memory, larger distances are replaced as a whole
+    static constexpr int MaxDistance = 2048;
+};
+
+} // namespace Internal
+} // namespace QNVim
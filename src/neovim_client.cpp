@@ -0,0 +1,151 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "neovim_client.h"
+
+#include "log.h"
+
+#include <msgpackrequest.h>
+
+#include <QElapsedTimer>
+#include <QTimer>
+
+namespace QNVim {
+namespace Internal {
+
+void NeovimReply::setTimeout(int msec) {
+    QTimer::singleShot(msec, this, &NeovimReply::timeout);
+}
+
+NeovimClient::NeovimClient(const QStringList &arguments, QObject *parent)
+    : QObject(parent) {
+    mThread.setObjectName("QNVim I/O");
+    mThread.start();
+
+    mWorker = new QObject;
+    mWorker->moveToThread(&mThread);
+    connect(&mThread, &QThread::finished, mWorker, &QObject::deleteLater);
+
+    QMetaObject::invokeMethod(mWorker, [=]() { start(arguments); }, Qt::QueuedConnection);
+}
+
+NeovimClient::~NeovimClient() {
+    // Requests posted before are handled first
+    QMetaObject::invokeMethod(mWorker, [=]() {
+        delete mConnector;
+        mConnector = nullptr;
+    }, Qt::BlockingQueuedConnection);
+
+    mThread.quit();
+    mThread.wait();
+}
+
+bool NeovimClient::isReady() const {
+    return mReady;
+}
+
+quint64 NeovimClient::channel() const {
+    return mChannel;
+}
+
+void NeovimClient::fatalTimeout() {
+    QMetaObject::invokeMethod(mWorker, [=]() {
+        if (mConnector)
+            mConnector->fatalTimeout();
+    }, Qt::QueuedConnection);
+}
+
+NeovimReply *NeovimClient::post(Request request) {
+    const quint64 id = ++mRequestCounter;
+    auto reply = new NeovimReply(this);
+    mReplies.insert(id, reply);
+
+    QMetaObject::invokeMethod(mWorker, [=]() {
+        if (not mConnector)
+            return send({Message::Error, id, {}, QStringLiteral("Neovim is not running")});
+
+        auto msgpackRequest = request(mConnector);
+        connect(msgpackRequest, &NeovimQt::MsgpackRequest::finished, mWorker,
+                [=](quint32, quint64, const QVariant &result) { send({Message::Finished, id, {}, result}); });
+        connect(msgpackRequest, &NeovimQt::MsgpackRequest::error, mWorker,
+                [=](quint32, quint64, const QVariant &error) { send({Message::Error, id, {}, error}); });
+    }, Qt::QueuedConnection);
+
+    return reply;
+}
+
+void NeovimClient::start(const QStringList &arguments) {
+    mConnector = NeovimQt::NeovimConnector::spawn(arguments);
+    mConnector->setParent(mWorker);
+
+    connect(mConnector, &NeovimQt::NeovimConnector::ready, mWorker, [=]() {
+        send({Message::Ready, mConnector->channel()});
+
+        // Messages are decoded here, the GUI thread receives ready to use variants
+        connect(mConnector->api2(), &NeovimQt::NeovimApi2::neovimNotification, mWorker,
+                [=](const QByteArray &name, const QVariantList &args) {
+                    if (name == "redraw")
+                        send({Message::Redraw, 0, {}, {}, Redraw::parse(args)});
+                    else
+                        send({Message::Notification, 0, name, args});
+                });
+    });
+}
+
+void NeovimClient::send(Message message) {
+    mMessages.push(std::move(message));
+
+    if (not mDispatchScheduled.exchange(true))
+        QMetaObject::invokeMethod(this, &NeovimClient::dispatch, Qt::QueuedConnection);
+}
+
+void NeovimClient::dispatch() {
+    mDispatchScheduled = false;
+
+    // Yield to other events after a while, e.g. during a redraw burst, so that the GUI stays responsive
+    QElapsedTimer timer;
+    timer.start();
+
+    Message message;
+    while (mMessages.pop(message)) {
+        switch (message.type) {
+        case Message::Ready:
+            mReady = true;
+            mChannel = message.id;
+            emit ready();
+            break;
+
+        case Message::Notification:
+            emit notification(message.name, message.value.toList());
+            break;
+
+        case Message::Redraw:
+            emit redraw(message.events);
+            break;
+
+        case Message::Finished:
+        case Message::Error: {
+            const QPointer<NeovimReply> reply = mReplies.take(message.id);
+            if (not reply)
+                break;
+
+            if (message.type == Message::Finished)
+                emit reply->finished(message.value);
+            else
+                emit reply->error(message.value);
+
+            reply->deleteLater();
+            break;
+        }
+        }
+
+        if (timer.elapsed() > 10) {
+            if (not mDispatchScheduled.exchange(true))
+                QMetaObject::invokeMethod(this, &NeovimClient::dispatch, Qt::QueuedConnection);
+            return;
+        }
+    }
+}
+
+} // namespace Internal
+} // namespace QNVim
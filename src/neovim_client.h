@@ -0,0 +1,137 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "redraw_events.h"
+#include "spsc_queue.h"
+
+#include <neovimconnector.h>
+
+#include <QHash>
+#include <QPointer>
+#include <QThread>
+#include <QVariant>
+
+#include <atomic>
+#include <functional>
+#include <tuple>
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Result of a request made through NeovimClient, it lives in the GUI thread
+ * and deletes itself after emitting finished() or error().
+ */
+class NeovimReply : public QObject {
+    Q_OBJECT
+
+  public:
+    using QObject::QObject;
+
+    /**
+     * Emits timeout() if there is no response after the given time.
+     */
+    void setTimeout(int msec);
+
+  signals:
+    void finished(const QVariant &result);
+    void error(const QVariant &error);
+    void timeout();
+};
+
+/**
+ * Connection to Neovim, that reads and decodes its messages on a dedicated thread.
+ *
+ * NeovimQt::NeovimConnector lives in the I/O thread. Requests are posted to it,
+ * while replies and notifications come back through a lock-free queue in the order,
+ * in which Neovim has sent them, and are dispatched in the GUI thread.
+ *
+ * "redraw" notifications are delivered through redraw() instead of notification().
+ */
+class NeovimClient : public QObject {
+    Q_OBJECT
+
+  public:
+    explicit NeovimClient(const QStringList &arguments, QObject *parent = nullptr);
+    ~NeovimClient() override;
+
+    bool isReady() const;
+    quint64 channel() const;
+
+    /**
+     * Calls a method of NeovimApi2 or NeovimApi6 in the I/O thread, e.g.
+     * call(&NeovimQt::NeovimApi2::nvim_command, "echo 1").
+     */
+    template <typename Api, typename... Params, typename... Args>
+    NeovimReply *call(NeovimQt::MsgpackRequest *(Api::*method)(Params...), Args &&...args) {
+        return post([=, arguments = std::make_tuple(std::forward<Args>(args)...)](NeovimQt::NeovimConnector *nvim) {
+            return std::apply([&](const auto &...a) { return (api<Api>(nvim)->*method)(a...); }, arguments);
+        });
+    }
+
+    void fatalTimeout();
+
+  signals:
+    void ready();
+    void notification(const QByteArray &name, const QVariantList &args);
+    // "redraw" notification, that is parsed in the I/O thread
+    void redraw(const QList<Redraw::Event> &events);
+
+  private:
+    struct Message {
+        enum Type {
+            Ready,
+            Notification,
+            Redraw,
+            Finished,
+            Error,
+        };
+
+        Type type = Ready;
+        quint64 id = 0;
+        QByteArray name;
+        QVariant value;
+        QList<Redraw::Event> events;
+    };
+
+    using Request = std::function<NeovimQt::MsgpackRequest *(NeovimQt::NeovimConnector *)>;
+
+    template <typename Api>
+    static Api *api(NeovimQt::NeovimConnector *);
+
+    NeovimReply *post(Request request);
+
+    // Called in the I/O thread
+    void start(const QStringList &arguments);
+    void send(Message message);
+
+    void dispatch();
+
+    QThread mThread;
+    // Context of the I/O thread
+    QObject *mWorker = nullptr;
+    NeovimQt::NeovimConnector *mConnector = nullptr;
+
+    SpscQueue<Message> mMessages;
+    std::atomic<bool> mDispatchScheduled{false};
+
+    bool mReady = false;
+    quint64 mChannel = 0;
+    quint64 mRequestCounter = 0;
+    QHash<quint64, QPointer<NeovimReply>> mReplies;
+};
+
+template <>
+inline NeovimQt::NeovimApi2 *NeovimClient::api<NeovimQt::NeovimApi2>(NeovimQt::NeovimConnector *nvim) {
+    return nvim->api2();
+}
+
+template <>
+inline NeovimQt::NeovimApi6 *NeovimClient::api<NeovimQt::NeovimApi6>(NeovimQt::NeovimConnector *nvim) {
+    return nvim->api6();
+}
+
+} // namespace Internal
+} // namespace QNVim
@@ -0,0 +1,374 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "neovim_highlighter.h"
+
+#include "log.h"
+#include "neovim_client.h"
+#include "utf_columns.h"
+
+#include <texteditor/syntaxhighlighter.h>
+#include <texteditor/textdocument.h>
+#include <texteditor/texteditor.h>
+
+#include <QScrollBar>
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QTextLayout>
+
+namespace QNVim {
+namespace Internal {
+
+namespace {
+
+// Notifies about lines, which highlighting may have changed after a reparse.
+// Neovim caches the parser of a buffer, so its callback is registered once and
+// only notifies while a highlighter of the buffer is active.
+const char *const RegisterScript =
+    "local buffer, channel = ...\n"
+    "local ok, parser = pcall(vim.treesitter.get_parser, buffer)\n"
+    "if not ok or not parser then\n"
+    "    return false\n"
+    "end\n"
+    "vim.b[buffer].qnvim_highlight_active = true\n"
+    "if vim.b[buffer].qnvim_highlight_registered == tostring(parser) then\n"
+    "    return true\n"
+    "end\n"
+    "vim.b[buffer].qnvim_highlight_registered = tostring(parser)\n"
+    "parser:register_cbs({on_changedtree = function(changes)\n"
+    "    if not vim.b[buffer].qnvim_highlight_active then\n"
+    "        return\n"
+    "    end\n"
+    "    local lines = {}\n"
+    "    for _, change in ipairs(changes) do\n"
+    "        table.insert(lines, {change[1], change[#change == 6 and 4 or 3] + 1})\n"
+    "    end\n"
+    "    if #lines > 0 then\n"
+    "        vim.rpcnotify(channel, 'Gui', 'highlightChanged', buffer, lines)\n"
+    "    end\n"
+    "end})\n"
+    "return true";
+
+const char *const UnregisterScript =
+    "local buffer = ...\n"
+    "if vim.api.nvim_buf_is_valid(buffer) then\n"
+    "    vim.b[buffer].qnvim_highlight_active = false\n"
+    "end";
+
+// Captures of the lines as {start_row, start_col, end_row, end_col, hl_id}
+// and attributes of their highlight groups
+const char *const CapturesScript =
+    "local buffer, ranges = ...\n"
+    "local ok, parser = pcall(vim.treesitter.get_parser, buffer)\n"
+    "if not ok or not parser then\n"
+    "    return {{}, vim.empty_dict()}\n"
+    "end\n"
+    "parser:parse()\n"
+    "local captures, groups = {}, vim.empty_dict()\n"
+    "local getQuery = vim.treesitter.query.get or vim.treesitter.query.get_query\n"
+    "parser:for_each_tree(function(tree, languageTree)\n"
+    "    local language = languageTree:lang()\n"
+    "    local query = getQuery(language, 'highlights')\n"
+    "    if not query then\n"
+    "        return\n"
+    "    end\n"
+    "    for _, range in ipairs(ranges) do\n"
+    "        for id, node in query:iter_captures(tree:root(), buffer, range[1], range[2]) do\n"
+    "            local hl = vim.api.nvim_get_hl_id_by_name('@' .. query.captures[id] .. '.' .. language)\n"
+    "            local key = tostring(hl)\n"
+    "            if groups[key] == nil then\n"
+    "                groups[key] = vim.api.nvim_get_hl(0, {id = hl, link = false})\n"
+    "            end\n"
+    "            local startRow, startCol, endRow, endCol = node:range()\n"
+    "            table.insert(captures, {startRow, startCol, endRow, endCol, hl})\n"
+    "        end\n"
+    "    end\n"
+    "end)\n"
+    "return {captures, groups}";
+
+bool isEmpty(const QPair<int, int> &range) {
+    return range.first >= range.second;
+}
+
+// Converts Neovim's byte column to UTF-16 index
+int charIndex(const QString &text, int byteColumn) {
+    return int(utf16Length(text, byteColumn));
+}
+
+} // namespace
+
+NeovimHighlighter::NeovimHighlighter(NeovimClient *nvim, int buffer, TextEditor::TextEditorWidget *editor,
+                                     SyncCheck isSynced)
+    : QObject(editor), mNVim{nvim}, mBuffer{buffer}, mEditor{editor}, mIsSynced{std::move(isSynced)} {
+}
+
+NeovimHighlighter::~NeovimHighlighter() {
+    if (mNVim->isReady())
+        mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua, UnregisterScript, QVariantList{mBuffer});
+
+    if (not mStarted or not mEditor)
+        return;
+
+    // Qt Creator's highlighter formats the whole document again
+    removeFormats();
+    if (auto highlighter = mEditor->textDocument()->syntaxHighlighter())
+        highlighter->setDocument(mEditor->document());
+}
+
+void NeovimHighlighter::start() {
+    auto request = mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua, RegisterScript,
+                               QVariantList{mBuffer, mNVim->channel()});
+    connect(request, &NeovimReply::error, this, &QObject::deleteLater);
+    connect(request, &NeovimReply::finished, this, [=](const QVariant &v) {
+        if (not mEditor or not v.toBool()) {
+            qDebug(Main) << "No treesitter parser for buffer" << mBuffer;
+            deleteLater();
+            return;
+        }
+
+        mStarted = true;
+        if (auto highlighter = mEditor->textDocument()->syntaxHighlighter())
+            highlighter->setDocument(nullptr);
+
+        QTextDocument *document = mEditor->document();
+        mBlockCount = document->blockCount();
+        mRevision = document->revision();
+
+        connect(document, &QTextDocument::contentsChange, this, &NeovimHighlighter::contentsChange);
+        connect(mEditor->verticalScrollBar(), &QScrollBar::valueChanged, this, &NeovimHighlighter::scheduleUpdate);
+        invalidate(0, -1);
+    });
+}
+
+void NeovimHighlighter::invalidate(int first, int last) {
+    if (not mStarted or not mEditor)
+        return;
+
+    if (last < 0)
+        last = mEditor->document()->blockCount();
+
+    Range range{qMax(0, first), last};
+    if (isEmpty(range))
+        return;
+
+    // Merge with the overlapping and adjacent ranges
+    QList<Range> invalid;
+    bool inserted = false;
+    for (const Range &other : std::as_const(mInvalid)) {
+        if (other.second < range.first) {
+            invalid << other;
+        } else if (range.second < other.first) {
+            if (not inserted) {
+                invalid << range;
+                inserted = true;
+            }
+            invalid << other;
+        } else {
+            range = {qMin(range.first, other.first), qMax(range.second, other.second)};
+        }
+    }
+    if (not inserted)
+        invalid << range;
+
+    mInvalid = invalid;
+    scheduleUpdate();
+}
+
+void NeovimHighlighter::contentsChange(int position, int, int charsAdded) {
+    QTextDocument *document = mEditor->document();
+    const int blockCount = document->blockCount();
+    const int lineDelta = blockCount - mBlockCount;
+    mBlockCount = blockCount;
+
+    // Formats don't change the revision, including the ones set here
+    if (mApplying or document->revision() == mRevision)
+        return;
+    mRevision = document->revision();
+
+    const int first = document->findBlock(position).blockNumber();
+    const int last = document->findBlock(position + charsAdded).blockNumber() + 1;
+
+    // Formats move together with their blocks, so only the ranges have to be moved
+    for (Range &range : mInvalid) {
+        if (range.first > first)
+            range.first = qMax(first, range.first + lineDelta);
+        if (range.second > first)
+            range.second = qMax(first, range.second + lineDelta);
+    }
+    mInvalid.removeIf(isEmpty);
+
+    invalidate(first, last);
+}
+
+void NeovimHighlighter::scheduleUpdate() {
+    if (mUpdateScheduled)
+        return;
+
+    mUpdateScheduled = true;
+    QMetaObject::invokeMethod(this, &NeovimHighlighter::update, Qt::QueuedConnection);
+}
+
+void NeovimHighlighter::update() {
+    mUpdateScheduled = false;
+    if (not mEditor or mInFlight or mInvalid.isEmpty())
+        return;
+
+    // Called again once the pushed changes have reached Neovim
+    if (not mIsSynced())
+        return;
+
+    const int first = qMax(0, mEditor->firstVisibleBlockNumber() - MarginLines);
+    const int last = mEditor->lastVisibleBlockNumber() + 1 + MarginLines;
+
+    // Invalid lines outside of the window stay invalid until they are shown
+    QList<Range> ranges;
+    QList<Range> rest;
+    QVariantList arguments;
+    for (const Range &range : std::as_const(mInvalid)) {
+        const int from = qMax(range.first, first);
+        const int to = qMin(range.second, last);
+        if (from >= to) {
+            rest << range;
+            continue;
+        }
+
+        if (range.first < from)
+            rest << Range{range.first, from};
+        ranges << Range{from, to};
+        arguments << QVariant(QVariantList{from, to});
+        if (to < range.second)
+            rest << Range{to, range.second};
+    }
+
+    if (ranges.isEmpty())
+        return;
+
+    mInvalid = rest;
+    mInFlight = true;
+
+    const int revision = mEditor->document()->revision();
+    auto request = mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua, CapturesScript,
+                               QVariantList{mBuffer, arguments});
+    connect(request, &NeovimReply::error, this, [=](const QVariant &error) {
+        qDebug(Main) << "Failed to get highlights of buffer" << mBuffer << error;
+        mInFlight = false;
+    });
+    connect(request, &NeovimReply::finished, this, [=](const QVariant &v) {
+        mInFlight = false;
+        if (not mEditor)
+            return;
+
+        // Lines may have moved since the request, so they are requested again
+        if (mEditor->document()->revision() != revision) {
+            for (const Range &range : ranges)
+                invalidate(range.first, range.second);
+            return;
+        }
+
+        const QVariantList result = v.toList();
+        apply(ranges, result.value(0).toList(), result.value(1).toMap());
+
+        // The rest of the window, if it has scrolled meanwhile
+        scheduleUpdate();
+    });
+}
+
+void NeovimHighlighter::apply(const QList<Range> &ranges, const QVariantList &captures, const QVariantMap &groups) {
+    QTextDocument *document = mEditor->document();
+
+    QHash<int, QTextCharFormat> formats;
+    for (auto it = groups.cbegin(); it != groups.cend(); ++it)
+        formats.insert(it.key().toInt(), format(it.value().toMap()));
+
+    auto isRequested = [&](int line) {
+        for (const Range &range : ranges) {
+            if (line >= range.first and line < range.second)
+                return true;
+        }
+        return false;
+    };
+
+    QHash<int, QList<QTextLayout::FormatRange>> lineFormats;
+    for (const QVariant &capture : captures) {
+        const QVariantList fields = capture.toList();
+        if (fields.size() < 5)
+            continue;
+
+        const auto format = formats.constFind(fields[4].toInt());
+        if (format == formats.cend() or format->isEmpty())
+            continue;
+
+        const int startRow = fields[0].toInt();
+        const int endRow = fields[2].toInt();
+
+        // Nodes may span much more than the requested lines, e.g. comments
+        const int firstLine = qMax(startRow, ranges.constFirst().first);
+        const int lastLine = qMin(endRow, ranges.constLast().second - 1);
+        QTextBlock block = document->findBlockByNumber(firstLine);
+        for (int line = firstLine; line <= lastLine and block.isValid(); ++line, block = block.next()) {
+            if (not isRequested(line))
+                continue;
+
+            const QString text = block.text();
+            const int from = line == startRow ? charIndex(text, fields[1].toInt()) : 0;
+            const int to = line == endRow ? charIndex(text, fields[3].toInt()) : text.size();
+            if (to > from)
+                lineFormats[line] << QTextLayout::FormatRange{from, to - from, *format};
+        }
+    }
+
+    // Lines without captures lose their old formats
+    mApplying = true;
+    for (const Range &range : ranges) {
+        QTextBlock block = document->findBlockByNumber(range.first);
+        for (int line = range.first; line < range.second and block.isValid(); ++line, block = block.next()) {
+            const auto formats = lineFormats.value(line);
+            if (formats.isEmpty() and block.layout()->formats().isEmpty())
+                continue;
+
+            block.layout()->setFormats(formats);
+            document->markContentsDirty(block.position(), block.length());
+        }
+    }
+    mApplying = false;
+}
+
+QTextCharFormat NeovimHighlighter::format(const QVariantMap &attributes) const {
+    QTextCharFormat format;
+
+    if (attributes.contains("fg"))
+        format.setForeground(QColor(QRgb(attributes["fg"].toLongLong())));
+    if (attributes.contains("bg"))
+        format.setBackground(QColor(QRgb(attributes["bg"].toLongLong())));
+    if (attributes.value("bold").toBool())
+        format.setFontWeight(QFont::Bold);
+    if (attributes.value("italic").toBool())
+        format.setFontItalic(true);
+    if (attributes.value("underline").toBool())
+        format.setFontUnderline(true);
+    if (attributes.value("undercurl").toBool())
+        format.setUnderlineStyle(QTextCharFormat::WaveUnderline);
+    if (attributes.contains("sp"))
+        format.setUnderlineColor(QColor(QRgb(attributes["sp"].toLongLong())));
+    if (attributes.value("strikethrough").toBool())
+        format.setFontStrikeOut(true);
+
+    return format;
+}
+
+void NeovimHighlighter::removeFormats() {
+    QTextDocument *document = mEditor->document();
+
+    mApplying = true;
+    for (QTextBlock block = document->firstBlock(); block.isValid(); block = block.next()) {
+        if (block.layout()->formats().isEmpty())
+            continue;
+
+        block.layout()->clearFormats();
+        document->markContentsDirty(block.position(), block.length());
+    }
+    mApplying = false;
+}
+
+} // namespace Internal
+} // namespace QNVim
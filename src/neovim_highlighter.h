@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QPointer>
+#include <QTextCharFormat>
+
+#include <functional>
+
+namespace TextEditor {
+class TextEditorWidget;
+}
+
+namespace QNVim {
+namespace Internal {
+
+class NeovimClient;
+
+/**
+ * Highlights a document with captures of Neovim's treesitter parser instead of
+ * Qt Creator's highlighter, which is detached from the document meanwhile.
+ *
+ * Lines are invalidated by edits and by the trees Neovim reparses, then the invalid
+ * lines around the visible ones are requested and their QTextLayout formats are set.
+ * Lines, that are neither invalid nor visible, are never touched. Captures are only
+ * requested while Neovim's buffer matches the document, otherwise they would describe
+ * the text before the changes, that are still on their way to Neovim.
+ */
+class NeovimHighlighter : public QObject {
+    Q_OBJECT
+
+  public:
+    /**
+     * Whether Neovim has received all changes of the document and none are in flight.
+     */
+    using SyncCheck = std::function<bool()>;
+
+    NeovimHighlighter(NeovimClient *, int buffer, TextEditor::TextEditorWidget *, SyncCheck isSynced);
+    ~NeovimHighlighter() override;
+
+    /**
+     * Registers for the changes of the buffer's syntax trees. The highlighter
+     * deletes itself if Neovim has no parser for the buffer.
+     */
+    void start();
+
+    /**
+     * Marks lines [first, last) as invalid, a negative @p last means "until the end".
+     */
+    void invalidate(int first, int last);
+
+    /**
+     * Requests the invalid lines around the visible ones, as soon as the buffer is synced.
+     */
+    void scheduleUpdate();
+
+  private:
+    using Range = QPair<int, int>;
+
+    void contentsChange(int position, int charsRemoved, int charsAdded);
+    void update();
+    void apply(const QList<Range> &ranges, const QVariantList &captures, const QVariantMap &groups);
+    QTextCharFormat format(const QVariantMap &attributes) const;
+    void removeFormats();
+
+    NeovimClient *mNVim;
+    int mBuffer;
+    QPointer<TextEditor::TextEditorWidget> mEditor;
+    SyncCheck mIsSynced;
+
+    // Sorted, disjoint [first, last) ranges of lines to request
+    QList<Range> mInvalid;
+    int mBlockCount = 0;
+    int mRevision = 0;
+
+    bool mStarted = false;
+    bool mUpdateScheduled = false;
+    bool mInFlight = false;
+    bool mApplying = false;
+
+    // Lines around the visible ones, that are highlighted too
+    static constexpr int MarginLines = 100;
+};
+
+} // namespace Internal
+} // namespace QNVim
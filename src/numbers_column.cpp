@@ -5,12 +5,17 @@
 
 #include <texteditor/fontsettings.h>
 #include <texteditor/textdocument.h>
+#include <texteditor/textdocumentlayout.h>
 #include <texteditor/texteditor.h>
 #include <texteditor/texteditorsettings.h>
 
+#include <QAbstractTextDocumentLayout>
+#include <QPaintEvent>
 #include <QPainter>
 #include <QScrollBar>
 
+#include <algorithm>
+
 namespace QNVim {
 namespace Internal {
 
@@ -28,24 +33,44 @@ void NumbersColumn::setEditor(TextEditor::TextEditorWidget *editor) {
     if (mEditor) {
         mEditor->removeEventFilter(this);
         disconnect(mEditor, &QPlainTextEdit::cursorPositionChanged,
-                   this, &NumbersColumn::updateGeometry);
+                   this, &NumbersColumn::updateNumbers);
         disconnect(mEditor->verticalScrollBar(), &QScrollBar::valueChanged,
-                   this, &NumbersColumn::updateGeometry);
+                   this, &NumbersColumn::updateNumbers);
         disconnect(mEditor->document(), &QTextDocument::contentsChanged,
+                   this, &NumbersColumn::updateNumbers);
+        disconnect(mEditor->document(), &QTextDocument::blockCountChanged,
+                   this, &NumbersColumn::invalidateHiddenRanges);
+        disconnect(mEditor->textDocument(), &TextEditor::TextDocument::fontSettingsChanged,
                    this, &NumbersColumn::updateGeometry);
+        if (auto layout = qobject_cast<TextEditor::TextDocumentLayout *>(mEditor->document()->documentLayout()))
+            disconnect(layout, &TextEditor::TextDocumentLayout::foldChanged,
+                       this, &NumbersColumn::invalidateHiddenRanges);
+        disconnect(mEditor->document()->documentLayout(), &QAbstractTextDocumentLayout::documentSizeChanged,
+                   this, &NumbersColumn::invalidateView);
     }
 
     mEditor = editor;
+    mHiddenRanges.clear();
+    mHiddenRangesValid = false;
     setParent(mEditor);
 
     if (mEditor) {
         mEditor->installEventFilter(this);
         connect(mEditor, &QPlainTextEdit::cursorPositionChanged,
-                this, &NumbersColumn::updateGeometry);
+                this, &NumbersColumn::updateNumbers);
         connect(mEditor->verticalScrollBar(), &QScrollBar::valueChanged,
-                this, &NumbersColumn::updateGeometry);
+                this, &NumbersColumn::updateNumbers);
         connect(mEditor->document(), &QTextDocument::contentsChanged,
+                this, &NumbersColumn::updateNumbers);
+        connect(mEditor->document(), &QTextDocument::blockCountChanged,
+                this, &NumbersColumn::invalidateHiddenRanges);
+        connect(mEditor->textDocument(), &TextEditor::TextDocument::fontSettingsChanged,
                 this, &NumbersColumn::updateGeometry);
+        if (auto layout = qobject_cast<TextEditor::TextDocumentLayout *>(mEditor->document()->documentLayout()))
+            connect(layout, &TextEditor::TextDocumentLayout::foldChanged,
+                    this, &NumbersColumn::invalidateHiddenRanges);
+        connect(mEditor->document()->documentLayout(), &QAbstractTextDocumentLayout::documentSizeChanged,
+                this, &NumbersColumn::invalidateView);
         show();
     } else
         hide();
@@ -54,59 +79,239 @@ void NumbersColumn::setEditor(TextEditor::TextEditorWidget *editor) {
 }
 
 void NumbersColumn::setNumber(bool number) {
+    if (number == mNumber)
+        return;
+
     mNumber = number;
-    updateGeometry();
+    mView = View();
+    updateNumbers();
 }
 
 void NumbersColumn::paintEvent(QPaintEvent *event) {
+    if (not mEditor or mCanvas.isNull())
+        return;
+
+    QPainter p(this);
+    const QRect rect = event->rect();
+    const qreal ratio = mCanvas.devicePixelRatio();
+    p.drawPixmap(rect, mCanvas, QRectF(QPointF(rect.topLeft()) * ratio, QSizeF(rect.size()) * ratio));
+}
+
+bool NumbersColumn::eventFilter(QObject *, QEvent *event) {
+    if (event->type() == QEvent::Resize or event->type() == QEvent::Move)
+        updateGeometry();
+
+    return false;
+}
+
+int NumbersColumn::visibleBlocksBetween(int first, int last) {
+    if (not mHiddenRangesValid)
+        updateHiddenRanges();
+
+    if (first > last)
+        return -visibleBlocksBetween(last, first);
+
+    return last - first - (hiddenBlocksBefore(last) - hiddenBlocksBefore(first));
+}
+
+int NumbersColumn::hiddenBlocksBefore(int blockNumber) const {
+    // Last range starting before the block
+    auto it = std::upper_bound(mHiddenRanges.cbegin(), mHiddenRanges.cend(), blockNumber,
+                               [](int number, const HiddenRange &range) { return number <= range.first; });
+    if (it == mHiddenRanges.cbegin())
+        return 0;
+
+    --it;
+    return it->hiddenBefore + qMin(blockNumber, it->last) - it->first;
+}
+
+void NumbersColumn::invalidateHiddenRanges() {
+    // New blocks are visible, so changing block count can only move existing ranges
+    const bool blockCountChanged = sender() == mEditor->document();
+    if (blockCountChanged and mHiddenRanges.isEmpty())
+        return;
+
+    mHiddenRangesValid = false;
+
+    // Folding doesn't necessarily move the first visible block or the cursor,
+    // but it changes the numbers. The layout is updated after the signal.
+    mView = View();
+    QMetaObject::invokeMethod(this, &NumbersColumn::updateNumbers, Qt::QueuedConnection);
+}
+
+void NumbersColumn::invalidateView() {
+    // Size of a plain text layout is its number of rows. Wrapping a line differently,
+    // e.g. after an edit or a change of the wrap mode, moves the rows below it without
+    // moving any block, so none of the view changes.
+    mView = View();
+    QMetaObject::invokeMethod(this, &NumbersColumn::updateNumbers, Qt::QueuedConnection);
+}
+
+void NumbersColumn::updateHiddenRanges() {
+    mHiddenRanges.clear();
+    mHiddenRangesValid = true;
+
+    int hidden = 0;
+    int number = 0;
+    for (QTextBlock block = mEditor->document()->firstBlock(); block.isValid(); block = block.next(), ++number) {
+        if (block.isVisible())
+            continue;
+
+        if (not mHiddenRanges.isEmpty() and mHiddenRanges.last().last == number)
+            ++mHiddenRanges.last().last;
+        else
+            mHiddenRanges << HiddenRange{number, number + 1, hidden};
+
+        ++hidden;
+    }
+}
+
+void NumbersColumn::updateGeometry() {
     if (not mEditor)
         return;
 
+    QFontMetrics fm(mEditor->textDocument()->fontSettings().font());
+    mLineHeight = fm.lineSpacing();
+
+    if (font() != mEditor->extraArea()->font()) {
+        setFont(mEditor->extraArea()->font());
+        mGlyphs.clear();
+    }
+
+    mExtraAreaGeometry = mEditor->extraArea()->geometry();
+    QRect rect = mExtraAreaGeometry.adjusted(0, 0, -3, 0);
+    bool marksVisible = mEditor->marksVisible();
+    bool lineNumbersVisible = mEditor->lineNumbersVisible();
+    bool foldMarksVisible = mEditor->codeFoldingVisible();
+
+    if (marksVisible and lineNumbersVisible)
+        rect.setLeft(mLineHeight);
+
+    if (foldMarksVisible and (marksVisible or lineNumbersVisible))
+        rect.setRight(rect.right() - (mLineHeight + mLineHeight % 2));
+
+    setGeometry(rect);
+
+    const qreal ratio = devicePixelRatioF();
+    const QSize canvasSize = (QSizeF(rect.size()) * ratio).toSize();
+    if (canvasSize.isEmpty()) {
+        mCanvas = QPixmap();
+    } else if (mCanvas.size() != canvasSize) {
+        mCanvas = QPixmap(canvasSize);
+        mCanvas.setDevicePixelRatio(ratio);
+    }
+
+    mView = View();
+    updateNumbers();
+}
+
+void NumbersColumn::updateNumbers() {
+    if (not mEditor or mCanvas.isNull())
+        return;
+
+    // Width of the extra area depends on the number of digits in line numbers
+    if (mEditor->extraArea()->geometry() != mExtraAreaGeometry)
+        return updateGeometry();
+
+    // Typing within a line doesn't change any number
+    const View view = currentView();
+    if (view == mView)
+        return;
+
+    const bool scrolled = view.cursorBlockNumber == mView.cursorBlockNumber
+                          and view.blockCount == mView.blockCount
+                          and mView.firstBlockNumber >= 0;
+
+    int dy = height();
+    if (scrolled) {
+        // Rows keep their numbers, so they only have to be moved to where their blocks are now
+        const QTextBlock oldFirstBlock = mEditor->document()->findBlockByNumber(mView.firstBlockNumber);
+        if (oldFirstBlock.isValid())
+            dy = mEditor->cursorRect(QTextCursor(oldFirstBlock)).y() - mView.top;
+    }
+
+    mView = view;
+
+    if (scrolled and qAbs(dy) < height()) {
+        const qreal ratio = mCanvas.devicePixelRatio();
+        mCanvas.scroll(0, qRound(dy * ratio), mCanvas.rect());
+        render(dy > 0 ? QRect(0, 0, width(), dy) : QRect(0, height() + dy, width(), -dy));
+    } else {
+        render(rect());
+    }
+
+    update();
+}
+
+NumbersColumn::View NumbersColumn::currentView() const {
+    View view;
+
     QTextCursor firstVisibleCursor = mEditor->cursorForPosition(QPoint(0, 0));
     QTextBlock firstVisibleBlock = firstVisibleCursor.block();
 
-    if (firstVisibleCursor.positionInBlock() > 0) {
+    if (firstVisibleCursor.positionInBlock() > 0)
         firstVisibleBlock = firstVisibleBlock.next();
-        firstVisibleCursor.setPosition(firstVisibleBlock.position());
+
+    view.cursorBlockNumber = mEditor->textCursor().blockNumber();
+    view.blockCount = mEditor->document()->blockCount();
+
+    if (firstVisibleBlock.isValid()) {
+        view.firstBlockNumber = firstVisibleBlock.blockNumber();
+        view.top = mEditor->cursorRect(QTextCursor(firstVisibleBlock)).y();
     }
 
-    QTextBlock block = mEditor->textCursor().block();
-    bool forward = firstVisibleBlock.blockNumber() > block.blockNumber();
-    int n = 0;
+    return view;
+}
 
-    while (block.isValid() and block != firstVisibleBlock) {
-        block = forward ? block.next() : block.previous();
+bool NumbersColumn::View::operator==(const View &other) const {
+    return cursorBlockNumber == other.cursorBlockNumber and firstBlockNumber == other.firstBlockNumber
+           and top == other.top and blockCount == other.blockCount;
+}
 
-        if (block.isVisible())
-            n += forward ? 1 : -1;
-    }
+void NumbersColumn::render(const QRect &area) {
+    QPainter p(&mCanvas);
+    p.setCompositionMode(QPainter::CompositionMode_Source);
+    p.fillRect(area, Qt::transparent);
+    p.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    p.setClipRect(area);
+
+    if (mView.firstBlockNumber < 0)
+        return;
+
+    // Relative number of the first visible block. The range doesn't include the cursor line
+    // itself, but it includes the first visible block, when it is after the cursor.
+    const int cursorBlockNumber = mView.cursorBlockNumber;
+    int n = mView.firstBlockNumber > cursorBlockNumber
+                ? visibleBlocksBetween(cursorBlockNumber + 1, mView.firstBlockNumber + 1)
+                : visibleBlocksBetween(cursorBlockNumber, mView.firstBlockNumber);
 
-    QPainter p(this);
     QPalette pal = mEditor->extraArea()->palette();
     const QColor fg = pal.color(QPalette::WindowText);
     const QColor bg = pal.color(QPalette::Window);
     p.setPen(fg);
+    p.setFont(font());
 
+    QTextBlock block = mEditor->document()->findBlockByNumber(mView.firstBlockNumber);
     qreal lineHeight = block.layout()->boundingRect().height();
-    QRectF rect(0, mEditor->cursorRect(firstVisibleCursor).y(), width(), lineHeight);
+    QRectF rect(0, mView.top, width(), lineHeight);
     bool hideLineNumbers = mEditor->lineNumbersVisible();
 
-    while (block.isValid()) {
+    while (block.isValid() and rect.y() <= area.bottom()) {
         if (block.isVisible()) {
-            if ((not mNumber or n != 0) and rect.intersects(event->rect())) {
+            if ((not mNumber or n != 0) and rect.intersects(area)) {
                 const int line = qAbs(n);
-                const QString number = QString::number(line);
 
                 if (hideLineNumbers)
                     p.fillRect(rect, bg);
-                if (hideLineNumbers or line < 100)
-                    p.drawText(rect, Qt::AlignRight | Qt::AlignVCenter, number);
+                if (hideLineNumbers or line < 100) {
+                    const QStaticText &text = glyph(line);
+                    p.drawStaticText(QPointF(rect.right() - text.size().width(),
+                                             rect.top() + (rect.height() - text.size().height()) / 2),
+                                     text);
+                }
             }
 
             rect.translate(0, lineHeight * block.lineCount());
-            if (rect.y() > height())
-                break;
-
             ++n;
         }
 
@@ -114,35 +319,19 @@ void NumbersColumn::paintEvent(QPaintEvent *event) {
     }
 }
 
-bool NumbersColumn::eventFilter(QObject *, QEvent *event) {
-    if (event->type() == QEvent::Resize or event->type() == QEvent::Move)
-        updateGeometry();
-
-    return false;
-}
+const QStaticText &NumbersColumn::glyph(int number) {
+    auto it = mGlyphs.find(number);
+    if (it != mGlyphs.end())
+        return *it;
 
-void NumbersColumn::updateGeometry() {
-    if (not mEditor)
-        return;
+    // Only numbers up to the height of the editor are used, unless it's huge
+    if (mGlyphs.size() > 1000)
+        mGlyphs.clear();
 
-    QFontMetrics fm(mEditor->textDocument()->fontSettings().font());
-    int lineHeight = fm.lineSpacing();
-    setFont(mEditor->extraArea()->font());
-
-    QRect rect = mEditor->extraArea()->geometry().adjusted(0, 0, -3, 0);
-    bool marksVisible = mEditor->marksVisible();
-    bool lineNumbersVisible = mEditor->lineNumbersVisible();
-    bool foldMarksVisible = mEditor->codeFoldingVisible();
-
-    if (marksVisible and lineNumbersVisible)
-        rect.setLeft(lineHeight);
-
-    if (foldMarksVisible and (marksVisible or lineNumbersVisible))
-        rect.setRight(rect.right() - (lineHeight + lineHeight % 2));
-
-    setGeometry(rect);
-
-    update();
+    QStaticText text(QString::number(number));
+    text.setTextFormat(Qt::PlainText);
+    text.prepare(QTransform(), font());
+    return *mGlyphs.insert(number, text);
 }
 
 } // namespace Internal
@@ -3,6 +3,10 @@
 
 #pragma once
 
+#include <QHash>
+#include <QList>
+#include <QPixmap>
+#include <QStaticText>
 #include <QWidget>
 
 namespace TextEditor {
@@ -22,11 +26,72 @@ class NumbersColumn : public QWidget {
 
     void setEditor(TextEditor::TextEditorWidget *);
     void setNumber(bool);
+
+    /**
+     * Recomputes geometry and fonts, e.g. after display or font settings change.
+     */
     void updateGeometry();
 
+    /**
+     * Repaints only the rows, which numbers have changed.
+     */
+    void updateNumbers();
+
   protected:
     void paintEvent(QPaintEvent *event);
     bool eventFilter(QObject *, QEvent *);
+
+  private:
+    /**
+     * What the rendered numbers depend on.
+     */
+    struct View {
+        int cursorBlockNumber = -1;
+        int firstBlockNumber = -1;
+        int top = 0;
+        int blockCount = 0;
+
+        bool operator==(const View &) const;
+    };
+
+    View currentView() const;
+
+    /**
+     * Renders rows intersecting the area to the canvas.
+     */
+    void render(const QRect &area);
+    const QStaticText &glyph(int number);
+
+    /**
+     * Consecutive folded blocks [first, last).
+     */
+    struct HiddenRange {
+        int first;
+        int last;
+        int hiddenBefore; ///< Number of hidden blocks before this range
+    };
+
+    /**
+     * Number of visible blocks in [first, last) or negated number in [last, first).
+     */
+    int visibleBlocksBetween(int first, int last);
+    int hiddenBlocksBefore(int blockNumber) const;
+    void invalidateHiddenRanges();
+    void invalidateView();
+    void updateHiddenRanges();
+
+    // Folds are rare, so hidden blocks are stored as ranges and
+    // visible blocks are counted with a binary search among them
+    QList<HiddenRange> mHiddenRanges;
+    bool mHiddenRangesValid = false;
+
+    // Numbers are rendered to the canvas, which is scrolled together with the editor,
+    // so that only the exposed rows have to be rendered again
+    QPixmap mCanvas;
+    View mView;
+    QRect mExtraAreaGeometry;
+    int mLineHeight = 0;
+    QHash<int, QStaticText> mGlyphs;
 };
 
 } // namespace Internal
@@ -0,0 +1,189 @@
+-- SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+-- SPDX-License-Identifier: MIT
+
+-- Runtime of the Neovim instance embedded into Qt Creator. The plugin loads it
+-- with --cmd when it spawns Neovim, so it's set up before any request is made.
+
+local M = {}
+
+local commands = {
+    Build = 'ProjectExplorer.Build',
+    BuildProject = 'ProjectExplorer.Build',
+    BuildAll = 'ProjectExplorer.BuildSession',
+    Rebuild = 'ProjectExplorer.Rebuild',
+    RebuildProject = 'ProjectExplorer.Rebuild',
+    RebuildAll = 'ProjectExplorer.RebuildSession',
+    Clean = 'ProjectExplorer.Clean',
+    CleanProject = 'ProjectExplorer.Clean',
+    CleanAll = 'ProjectExplorer.CleanSession',
+    Deploy = 'ProjectExplorer.Deploy',
+    DeployProject = 'ProjectExplorer.Deploy',
+    DeployAll = 'ProjectExplorer.DeploySession',
+    Run = 'ProjectExplorer.Run',
+    Debug = 'ProjectExplorer.Debug',
+    DebugStart = 'ProjectExplorer.Debug',
+    DebugContinue = 'ProjectExplorer.Continue',
+    QMake = 'Qt4Builder.RunQMake',
+    Target = 'ProjectExplorer.SelectTargetQuick',
+}
+
+-- Channel of Qt Creator, Neovim is embedded into it through stdio
+local function embedderChannel()
+    for _, channel in ipairs(vim.api.nvim_list_chans()) do
+        if channel.stream == 'stdio' then
+            return channel.id
+        end
+    end
+
+    -- Notifications are broadcasted to the subscribers of their event
+    return 0
+end
+
+local channel = 0
+local defaults = {}
+local lastState = {}
+
+local function notifyFileAutoCommand(event, args)
+    vim.rpcnotify(channel, 'Gui', 'fileAutoCommand', event, tostring(args.buf), vim.fn.expand('<afile>:p'),
+                  vim.bo.buftype, vim.bo.buflisted and 1 or 0, vim.bo.bufhidden, vim.g.QNVIM_always_text)
+end
+
+-- Sends the state, that Qt Creator mirrors, or only its changes if not forced
+function M.state(force)
+    local state = {
+        buffer = vim.api.nvim_get_current_buf(),
+        changedtick = vim.b.changedtick,
+        mode = vim.fn.mode(1),
+        modified = vim.bo.modified,
+        cursor = vim.list_slice(vim.fn.getpos('.'), 2, 3),
+        visual = vim.list_slice(vim.fn.getpos('v'), 2, 3),
+        number = vim.wo.number,
+        relativenumber = vim.wo.relativenumber,
+        wrap = vim.wo.wrap,
+        large_file_size = vim.g.QNVIM_large_file_size or defaults.large_file_size,
+        terminal_scrollback = vim.g.QNVIM_terminal_scrollback or defaults.terminal_scrollback,
+        neovim_highlight = vim.g.QNVIM_neovim_highlight or 0,
+        standby_timeout = vim.g.QNVIM_standby_timeout or defaults.standby_timeout,
+        shadow_budget = vim.g.QNVIM_shadow_budget or defaults.shadow_budget,
+        unload_timeout = vim.g.QNVIM_unload_timeout or defaults.unload_timeout,
+    }
+
+    local delta = {}
+    local changed = false
+    for key, value in pairs(state) do
+        if force or not vim.deep_equal(lastState[key], value) then
+            delta[key] = value
+            changed = true
+        end
+    end
+    lastState = state
+
+    if changed then
+        vim.rpcnotify(channel, 'Gui', 'state', delta)
+    end
+end
+
+-- Moves the cursor, leaving the insert mode undo block if needed
+function M.set_cursor(line, col)
+    vim.fn.cursor(line, col)
+    local mode = vim.fn.mode():sub(1, 1)
+    if mode == 'i' or mode == 'R' then
+        vim.cmd('normal! i\7u\3')
+    end
+    vim.fn.cursor(line, col)
+end
+
+-- Moves the cursor after a sync of the buffer, unless another buffer became current meanwhile
+function M.sync_cursor(buffer, line, col)
+    if vim.api.nvim_get_current_buf() == buffer then
+        vim.fn.cursor(line, col)
+    end
+end
+
+-- Creates the buffer of a document opened in Qt Creator from its text, so Neovim doesn't
+-- read the file. Returns the buffer and whether it was created rather than already open.
+-- Preloaded buffers aren't made current.
+function M.create_buffer(name, lines, line, col, acwrite, current)
+    local path = vim.fn.fnamemodify(name, ':p')
+    for _, buffer in ipairs(vim.api.nvim_list_bufs()) do
+        if vim.api.nvim_buf_get_name(buffer) == path then
+            if current then
+                vim.api.nvim_set_current_buf(buffer)
+            end
+            return {buffer, false}
+        end
+    end
+
+    local buffer = vim.api.nvim_create_buf(true, false)
+    vim.api.nvim_buf_set_name(buffer, path)
+
+    local options = vim.bo[buffer]
+    options.undolevels = -1
+    vim.api.nvim_buf_set_lines(buffer, 0, -1, true, lines)
+    options.undolevels = -123456
+    options.modified = false
+    if acwrite then
+        options.buftype = 'acwrite'
+    end
+    vim.api.nvim_buf_call(buffer, function() vim.cmd('filetype detect') end)
+
+    if current then
+        vim.api.nvim_set_current_buf(buffer)
+        vim.fn.cursor(line, col)
+    end
+    return {buffer, true}
+end
+
+function M.setup(options)
+    defaults = options or {}
+    channel = embedderChannel()
+
+    vim.g.QNVIM_always_text = true
+    vim.g.neovim_channel = channel
+
+    for name, id in pairs(commands) do
+        vim.api.nvim_create_user_command(name, function()
+            vim.rpcnotify(channel, 'Gui', 'triggerCommand', id)
+        end, {bar = true})
+    end
+
+    local group = vim.api.nvim_create_augroup('QNVim', {clear = true})
+    local function autocmd(events, opts)
+        opts.group = group
+        vim.api.nvim_create_autocmd(events, opts)
+    end
+
+    autocmd('BufReadCmd', {callback = function(args) notifyFileAutoCommand('BufReadCmd', args) end})
+    autocmd('TermOpen', {callback = function(args)
+        -- Terminals are rendered from the grid of their window, so it must not have a gutter
+        local options = vim.opt_local
+        options.number = false
+        options.relativenumber = false
+        options.signcolumn = 'no'
+        options.foldcolumn = '0'
+        notifyFileAutoCommand('TermOpen', args)
+    end})
+    autocmd('BufWriteCmd', {callback = function(args)
+        notifyFileAutoCommand('BufWriteCmd', args)
+        vim.bo.modified = false
+    end})
+    for _, event in ipairs({'BufEnter', 'BufDelete', 'BufHidden', 'BufWipeout'}) do
+        autocmd(event, {nested = true, callback = function(args) notifyFileAutoCommand(event, args) end})
+    end
+    autocmd('FileType', {pattern = 'help', command = 'set modifiable|read <afile>|set nomodifiable'})
+
+    autocmd({'CursorMoved', 'CursorMovedI', 'ModeChanged', 'TextChanged', 'TextChangedI', 'BufModifiedSet'},
+            {callback = function() M.state(false) end})
+    autocmd('OptionSet', {pattern = {'number', 'relativenumber', 'wrap'}, callback = function() M.state(false) end})
+    autocmd('BufEnter', {callback = function() M.state(true) end})
+
+    autocmd('VimEnter', {callback = function()
+        local rc = (vim.env.MYVIMRC or ''):gsub('init%.vim$', 'qnvim.vim'):gsub('init%.lua$', 'qnvim.vim')
+        vim.env.MYQVIMRC = rc
+        if vim.fn.filereadable(rc) == 1 then
+            vim.cmd('source ' .. vim.fn.fnameescape(rc))
+        end
+    end})
+end
+
+return M
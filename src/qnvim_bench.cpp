@@ -0,0 +1,450 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+/*
+ * Headless benchmark of the text synchronization between QTextDocument and Neovim.
+ *
+ * QNVimCore itself needs a running Qt Creator, so the benchmark repeats what its
+ * sync functions do with the same building blocks (ChangeTracker, BufferRegistry,
+ * replaceLines, replaceText and text_position.h conversions) on an offscreen
+ * QPlainTextEdit and a Neovim spawned with --embed.
+ *
+ * Usage: qnvim_bench [--iterations N] [--lines 1000,100000,1000000] [--nvim path]
+ */
+
+#include "buffer_registry.h"
+#include "change_tracker.h"
+#include "document_sync.h"
+#include "latency_stats.h"
+#include "text_position.h"
+
+#include <msgpackrequest.h>
+#include <neovimconnector.h>
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QPlainTextEdit>
+#include <QTemporaryDir>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextStream>
+#include <QTimer>
+
+#include <functional>
+
+using namespace QNVim::Internal;
+
+namespace {
+
+struct Result {
+    QString scenario;
+    QString file;
+    Histogram latency;
+    qint64 bytes = 0;
+    qint64 elapsed = 0;
+};
+
+class SyncBench : public QObject {
+  public:
+    SyncBench(NeovimQt::NeovimConnector *nvim, int iterations)
+        : mNVim{nvim}, mIterations{iterations} {
+        mDocument = mEditor.document();
+        mEditor.resize(800, 600);
+
+        connect(mNVim->api6(), &NeovimQt::NeovimApi6::neovimNotification, this,
+                [=](const QByteArray &name, const QVariantList &args) {
+                    if (name == "nvim_buf_lines_event")
+                        applyLines(args);
+                });
+
+        connect(mDocument, &QTextDocument::contentsChange, this, [=](int position, int removed, int added) {
+            if (mSettingTextFromVim)
+                mTracker.skipChange();
+            else
+                mTracker.contentsChange(position, removed, added);
+        });
+
+        mBuffer = wait(mNVim->api6()->nvim_get_current_buf()).toInt();
+    }
+
+    void run(const QString &file, const QStringList &lines) {
+        setDocument(lines);
+
+        measure("full push", file, 3, [=](qint64 &bytes) {
+            mRegistry.dropLines(mBuffer);
+            pushDocument(bytes);
+        });
+        measure("scattered push", file, 3, [=](qint64 &bytes) {
+            scatterEdits(ScatteredEdits);
+            pushDocument(bytes);
+        });
+        measure("full fetch", file, 3, [=](qint64 &bytes) {
+            fetchDocument(bytes);
+        });
+        measure("scattered resync", file, 3, [=](qint64 &bytes) {
+            scatterEdits(ScatteredEdits);
+            fetchDocument(bytes);
+        });
+        measure("char edit to vim", file, mIterations, [=](qint64 &bytes) {
+            editInQt(bytes);
+        });
+
+        attach();
+
+        measure("char edit from vim", file, mIterations, [=](qint64 &bytes) {
+            command(QStringLiteral("call setline(%1, 'x' .. getline(%1))").arg(randomLine() + 1), bytes);
+        });
+        measure(":%s substitution", file, 3, [=](qint64 &bytes) {
+            command("%s/e/E/g", bytes);
+            command("%s/E/e/g", bytes);
+        });
+        measure("visual block", file, mIterations, [=](qint64 &bytes) {
+            selectBlock(bytes);
+        });
+
+        detach();
+
+        QFile onDisk(mDirectory.filePath("open.txt"));
+        if (onDisk.open(QIODevice::WriteOnly | QIODevice::Truncate))
+            onDisk.write(lines.join('\n').toUtf8());
+        onDisk.close();
+
+        measure("open by :edit", file, 3, [=](qint64 &bytes) {
+            openByEdit(bytes);
+        });
+        measure("open by creation", file, 3, [=](qint64 &bytes) {
+            openByCreation(bytes);
+        });
+    }
+
+    const QList<Result> &results() const {
+        return mResults;
+    }
+
+  private:
+    static QVariant wait(NeovimQt::MsgpackRequest *request) {
+        QVariant result;
+        QEventLoop loop;
+
+        connect(request, &NeovimQt::MsgpackRequest::finished, &loop, [&](quint32, quint64, const QVariant &v) {
+            result = v;
+            loop.quit();
+        });
+        connect(request, &NeovimQt::MsgpackRequest::error, &loop, [&](quint32, quint64, const QVariant &e) {
+            qWarning() << "Request failed:" << e;
+            loop.quit();
+        });
+
+        loop.exec();
+        return result;
+    }
+
+    void measure(const QString &scenario, const QString &file, int iterations,
+                 const std::function<void(qint64 &)> &operation) {
+        Result result{scenario, file};
+
+        QElapsedTimer total;
+        total.start();
+
+        for (int i = 0; i < iterations; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            operation(result.bytes);
+            result.latency.record(timer.nsecsElapsed() / 1000);
+        }
+
+        result.elapsed = total.nsecsElapsed() / 1000;
+        mResults << result;
+    }
+
+    int randomLine() {
+        // Deterministic, so that runs are comparable
+        mSeed = mSeed * 1103515245 + 12345;
+        return int((mSeed >> 16) % quint32(mDocument->blockCount()));
+    }
+
+    void setDocument(const QStringList &lines) {
+        ++mSettingTextFromVim;
+        mDocument->setPlainText(lines.join('\n'));
+        --mSettingTextFromVim;
+        mTracker = ChangeTracker(mDocument);
+
+        qint64 bytes = 0;
+        mRegistry.dropLines(mBuffer);
+        pushDocument(bytes);
+    }
+
+    // QNVimCore::syncToVim
+    void pushDocument(qint64 &bytes) {
+        const QStringList lines = mDocument->toPlainText().split('\n');
+        const auto span = mRegistry.sync(mBuffer, lines);
+        if (span.first == span.last and span.first == span.newLast)
+            return;
+
+        QList<QByteArray> replacement;
+        replacement.reserve(span.newLast - span.first);
+        for (int i = span.first; i < span.newLast; ++i) {
+            replacement << lines[i].toUtf8();
+            bytes += replacement.constLast().size() + 1;
+        }
+
+        wait(mNVim->api6()->nvim_buf_set_lines(mBuffer, span.first, span.last, true, replacement));
+    }
+
+    // QNVimCore::requestBuffer
+    void fetchDocument(qint64 &bytes) {
+        const QVariantList lines = wait(mNVim->api6()->nvim_buf_get_lines(mBuffer, 0, -1, true)).toList();
+
+        QStringList text;
+        text.reserve(lines.size());
+        for (const auto &line : lines) {
+            const QByteArray data = line.toByteArray();
+            text << QString::fromUtf8(data);
+            bytes += data.size() + 1;
+        }
+        mRegistry.setLines(mBuffer, text);
+
+        ++mSettingTextFromVim;
+        replaceText(mDocument, text);
+        --mSettingTextFromVim;
+    }
+
+    // Edits, that Neovim hasn't received, e.g. lost in a changedtick gap
+    void scatterEdits(int count) {
+        ++mSettingTextFromVim;
+        for (int i = 0; i < count; ++i) {
+            QTextCursor cursor(mDocument->findBlockByNumber(randomLine()));
+            cursor.insertText("x");
+        }
+        --mSettingTextFromVim;
+    }
+
+    // QNVimCore::sendChangesToVim
+    void editInQt(qint64 &bytes) {
+        const QTextBlock block = mDocument->findBlockByNumber(randomLine());
+        QTextCursor cursor(block);
+        cursor.setPosition(block.position() + block.length() / 2);
+        cursor.insertText("x");
+
+        const auto change = mTracker.take();
+        QVariantList lines;
+        for (const auto &line : change.lines) {
+            lines << line.toUtf8();
+            bytes += lines.constLast().toByteArray().size() + 1;
+        }
+
+        if (change.column >= 0) {
+            wait(mNVim->api6()->nvim_execute_lua("vim.api.nvim_buf_set_text(...)",
+                                                 {mBuffer, change.firstLine, change.column,
+                                                  change.firstLine, change.column, lines}));
+
+            QStringList documentLines;
+            QTextBlock line = mDocument->findBlockByNumber(change.firstLine);
+            for (int i = 0; i < change.lines.size() and line.isValid(); ++i, line = line.next())
+                documentLines << line.text();
+            mRegistry.replaceLines(mBuffer, change.firstLine, change.lastLine, documentLines);
+        } else {
+            wait(mNVim->api6()->nvim_execute_lua("vim.api.nvim_buf_set_lines(...)",
+                                                 {mBuffer, change.firstLine, change.lastLine, true, lines}));
+            mRegistry.replaceLines(mBuffer, change.firstLine, change.lastLine, change.lines);
+        }
+
+        const QPoint position = vimPosition(mDocument, cursor.position());
+        wait(mNVim->api6()->nvim_command(QStringLiteral("call cursor(%1,%2)").arg(position.y()).arg(position.x()).toUtf8()));
+    }
+
+    // QNVimCore::handleBufferEvent, events arrive before the response to the command
+    void command(const QString &command, qint64 &bytes) {
+        mReceivedBytes = 0;
+        wait(mNVim->api6()->nvim_command(command.toUtf8()));
+        bytes += mReceivedBytes;
+    }
+
+    void applyLines(const QVariantList &args) {
+        QStringList lines;
+        const auto lineData = args.value(4).toList();
+        for (const auto &line : lineData) {
+            const QByteArray data = line.toByteArray();
+            lines << QString::fromUtf8(data);
+            mReceivedBytes += data.size() + 1;
+        }
+        mRegistry.replaceLines(mBuffer, args.value(2).toInt(), args.value(3).toInt(), lines);
+
+        ++mSettingTextFromVim;
+        replaceLines(mDocument, args.value(2).toInt(), args.value(3).toInt(), lines);
+        --mSettingTextFromVim;
+    }
+
+    // QNVimCore::syncSelectionToVim and syncCursorFromVim for a visual block
+    void selectBlock(qint64 &bytes) {
+        const int first = randomLine();
+        const int last = qMin(first + 50, mDocument->blockCount() - 1);
+        const QPoint anchor = vimPosition(mDocument, mDocument->findBlockByNumber(first).position());
+        const QTextBlock lastBlock = mDocument->findBlockByNumber(last);
+        const QPoint position = vimPosition(mDocument, lastBlock.position() + lastBlock.length() / 2);
+
+        // Visual mode ends with the command, so the selection is read back from the marks
+        const QByteArray command = QStringLiteral("normal! \x03%1G%2|\x16%3G%4|")
+                                       .arg(anchor.y()).arg(anchor.x())
+                                       .arg(position.y()).arg(position.x()).toUtf8();
+        mNVim->api6()->nvim_command(command);
+        bytes += command.size();
+
+        const QVariantList state = wait(mNVim->api6()->nvim_execute_lua(
+            "local v = vim.fn.getpos(\"'<\")\n"
+            "local c = vim.fn.getpos(\"'>\")\n"
+            "return {v[2], v[3], c[2], c[3]}", {})).toList();
+
+        const int vLine = state.value(0).toInt();
+        const int line = state.value(2).toInt();
+        const int vPosition = lineStart(mDocument, vLine) + charColumn(mDocument, vLine, state.value(1).toInt()) - 1;
+        const int cursorPosition = lineStart(mDocument, line) + charColumn(mDocument, line, state.value(3).toInt()) - 1;
+
+        QTextCursor cursor(mDocument);
+        cursor.setPosition(vPosition);
+        cursor.setPosition(cursorPosition, QTextCursor::KeepAnchor);
+        mEditor.setTextCursor(cursor);
+    }
+
+    // QNVimCore::editorOpened before buffers were created from documents
+    void openByEdit(qint64 &bytes) {
+        wait(mNVim->api6()->nvim_command(QStringLiteral("e %1").arg(mDirectory.filePath("open.txt")).toUtf8()));
+        const int buffer = wait(mNVim->api6()->nvim_eval("bufnr('')")).toInt();
+        wait(mNVim->api6()->nvim_buf_set_option(buffer, "undolevels", -1));
+
+        const QByteArray text = mDocument->toPlainText().toUtf8();
+        wait(mNVim->api6()->nvim_buf_set_lines(buffer, 0, -1, true, text.split('\n')));
+        wait(mNVim->api6()->nvim_command("call cursor(1,1)"));
+        bytes += text.size();
+
+        mNVim->api6()->nvim_buf_set_option(buffer, "undolevels", -123456);
+        wait(mNVim->api6()->nvim_buf_set_option(buffer, "modified", false));
+
+        wipe(buffer);
+    }
+
+    // QNVimCore::createBuffer
+    void openByCreation(qint64 &bytes) {
+        const QByteArray text = mDocument->toPlainText().toUtf8();
+        QVariantList lines;
+        for (const auto &line : text.split('\n'))
+            lines << line;
+        bytes += text.size();
+
+        const QVariantList result = wait(mNVim->api6()->nvim_execute_lua(
+            "return require('qnvim').create_buffer(...)",
+            {mDirectory.filePath("created.txt"), lines, 1, 1, false, true})).toList();
+
+        wipe(result.value(0).toInt());
+    }
+
+    // Both scenarios pay for it, so that every iteration opens a new buffer
+    void wipe(int buffer) {
+        wait(mNVim->api6()->nvim_command(QStringLiteral("buffer %1|bwipeout! %2").arg(mBuffer).arg(buffer).toUtf8()));
+    }
+
+    void attach() {
+        wait(mNVim->api6()->nvim_buf_attach(mBuffer, false, QVariantMap()));
+    }
+
+    void detach() {
+        wait(mNVim->api6()->nvim_buf_detach(mBuffer));
+    }
+
+    NeovimQt::NeovimConnector *mNVim;
+    int mIterations;
+    int mBuffer = 0;
+
+    QPlainTextEdit mEditor;
+    QTextDocument *mDocument;
+    ChangeTracker mTracker;
+    BufferRegistry mRegistry;
+    int mSettingTextFromVim = 0;
+    qint64 mReceivedBytes = 0;
+    quint32 mSeed = 1;
+
+    // Lines changed behind Neovim's back before a resync
+    static constexpr int ScatteredEdits = 500;
+
+    QTemporaryDir mDirectory;
+
+    QList<Result> mResults;
+};
+
+QStringList generateLines(int count, int length) {
+    static const QString pattern = QStringLiteral("    auto value = compute(index, \"lorem ipsum dolor sit amet\"); // текст ");
+
+    QStringList lines;
+    lines.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        QString line = QString::number(i) + pattern;
+        while (line.size() < length)
+            line += pattern;
+        lines << line.left(length);
+    }
+
+    return lines;
+}
+
+void printResults(const QList<Result> &results) {
+    QTextStream out(stdout);
+
+    out << qSetFieldWidth(20) << Qt::left << "scenario" << "file" << qSetFieldWidth(12) << Qt::right
+        << "ops" << "ops/s" << "p50 us" << "p99 us" << "max us" << "bytes" << qSetFieldWidth(0) << '\n';
+
+    for (const auto &result : results) {
+        const double seconds = result.elapsed / 1e6;
+        const qint64 opsPerSecond = seconds > 0 ? qint64(result.latency.count() / seconds) : 0;
+
+        out << qSetFieldWidth(20) << Qt::left << result.scenario << result.file << qSetFieldWidth(12) << Qt::right
+            << result.latency.count() << opsPerSecond << result.latency.percentile(50)
+            << result.latency.percentile(99) << result.latency.max() << result.bytes
+            << qSetFieldWidth(0) << '\n';
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption({"iterations", "Iterations of single edit scenarios.", "count", "200"});
+    parser.addOption({"lines", "Comma separated line counts of generated files.", "list", "1000,100000,1000000"});
+    parser.addOption({"nvim", "Neovim executable.", "path", "nvim"});
+    parser.process(app);
+
+    auto nvim = NeovimQt::NeovimConnector::spawn({"--clean", "--cmd", "set noswapfile undolevels=-1",
+                                                  "--cmd", "lua package.loaded.qnvim = dofile([==[" QNVIM_RUNTIME "]==])"},
+                                                 parser.value("nvim"));
+
+    QEventLoop loop;
+    QObject::connect(nvim, &NeovimQt::NeovimConnector::ready, &loop, &QEventLoop::quit);
+    QTimer::singleShot(10000, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    if (!nvim->isReady()) {
+        qCritical() << "Cannot start Neovim:" << nvim->errorString();
+        return 1;
+    }
+
+    SyncBench bench(nvim, parser.value("iterations").toInt());
+
+    const auto counts = parser.value("lines").split(',', Qt::SkipEmptyParts);
+    for (const auto &count : counts)
+        bench.run(count + " lines", generateLines(count.toInt(), 80));
+
+    bench.run("long lines", generateLines(100, 100000));
+
+    printResults(bench.results());
+
+    nvim->deleteLater();
+    return 0;
+}
@@ -8,6 +8,9 @@ namespace Constants {
 
 const char TOGGLE_ID[] = "QNVim.Toggle";
 const char MENU_ID[] = "QNVim.Menu";
+const char SHOW_STATS_ID[] = "QNVim.ShowLatencyStatistics";
+const char SAVE_STATS_ID[] = "QNVim.SaveLatencyStatistics";
+const char RESET_STATS_ID[] = "QNVim.ResetLatencyStatistics";
 
 } // namespace Constants
 } // namespace QNVim
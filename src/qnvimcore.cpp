@@ -3,18 +3,23 @@
 // SPDX-License-Identifier: MIT
 #include "qnvimcore.h"
 
+#include "command_line.h"
+#include "document_sync.h"
+#include "latency_stats.h"
 #include "numbers_column.h"
 #include "log.h"
+#include "neovim_client.h"
+#include "neovim_highlighter.h"
+#include "text_position.h"
 
 #include <coreplugin/actionmanager/actionmanager.h>
+#include <coreplugin/editormanager/documentmodel.h>
 #include <coreplugin/editormanager/editormanager.h>
 #include <coreplugin/editormanager/ieditor.h>
 #include <coreplugin/icontext.h>
 #include <coreplugin/statusbarmanager.h>
 
 #include <gui/input.h>
-#include <msgpackrequest.h>
-#include <neovimconnector.h>
 
 #include <projectexplorer/project.h>
 #include <projectexplorer/session.h>
@@ -26,7 +31,6 @@
 #include <texteditor/texteditorsettings.h>
 #include <texteditor/tabsettings.h>
 
-#include <utils/differ.h>
 #include <utils/fancylineedit.h>
 #include <utils/fileutils.h>
 #include <utils/osspecificaspects.h>
@@ -35,12 +39,13 @@
 #include <QApplication>
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QGuiApplication>
 #include <QLabel>
 #include <QMainWindow>
 #include <QMessageBox>
 #include <QPlainTextEdit>
-#include <QRegularExpression>
+#include <QSaveFile>
 #include <QScrollBar>
 #include <QStandardPaths>
 #include <QStyleHints>
@@ -48,21 +53,49 @@
 #include <QTextEdit>
 #include <QThread>
 
+#include <type_traits>
+
 namespace QNVim {
 namespace Internal {
 
+namespace {
+
+// Neovim can't read Qt resources, so the runtime is copied to the cache, unless it's there already
+QString installRuntime() {
+    QFile resource(":/qnvim/qnvim.lua");
+    if (!resource.open(QIODevice::ReadOnly)) {
+        qCritical(Main) << "Cannot read the QNVim runtime:" << resource.errorString();
+        return {};
+    }
+    const QByteArray contents = resource.readAll();
+
+    const QString path = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/qnvim/qnvim.lua";
+    QFile installed(path);
+    if (installed.open(QIODevice::ReadOnly) and installed.readAll() == contents)
+        return path;
+
+    // Other Qt Creator instances may be reading it meanwhile
+    QDir().mkpath(QFileInfo(path).path());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) or file.write(contents) != contents.size() or !file.commit()) {
+        qCritical(Main) << "Cannot install the QNVim runtime to" << path << file.errorString();
+        return {};
+    }
+
+    return path;
+}
+
+} // namespace
+
 QNVimCore::QNVimCore(QObject *parent)
-    : QObject{parent} {
+    : QObject{parent},
+      mPreloader{[this](Core::IEditor *editor, std::function<void()> finished) {
+          return preloadBuffer(editor, std::move(finished));
+      }} {
     qDebug(Main) << "QNVimCore::constructor";
 
-    mCMDLine = new QPlainTextEdit;
+    mCMDLine = new CommandLine;
     Core::StatusBarManager::addStatusBarWidget(mCMDLine, Core::StatusBarManager::First);
-    mCMDLine->document()->setDocumentMargin(0);
-    mCMDLine->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
-    mCMDLine->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
-    mCMDLine->setLineWrapMode(QPlainTextEdit::NoWrap);
-    mCMDLine->setMinimumWidth(200);
-    mCMDLine->setFocusPolicy(Qt::StrongFocus);
     mCMDLine->installEventFilter(this);
     mCMDLine->setFont(TextEditor::TextEditorSettings::instance()->fontSettings().font());
 
@@ -74,82 +107,177 @@ QNVimCore::QNVimCore(QObject *parent)
             this, &QNVimCore::editorAboutToClose);
     connect(Core::EditorManager::instance(), &Core::EditorManager::currentEditorChanged,
             this, &QNVimCore::editorOpened);
+    connect(Core::EditorManager::instance(), &Core::EditorManager::editorOpened,
+            &mPreloader, &BufferPreloader::enqueue);
 
     mNumbersColumn = new NumbersColumn();
-    mNVim = NeovimQt::NeovimConnector::spawn({"--cmd", "let g:QNVIM=1"});
-
-    connect(mNVim, &NeovimQt::NeovimConnector::ready, this, [=]() {
-        mNVim->api2()->nvim_command(QStringLiteral("\
-let g:QNVIM_always_text=v:true\n\
-let g:neovim_channel=%1\n\
-execute \"command -bar Build call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Build')\"\n\
-execute \"command -bar BuildProject call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Build')\"\n\
-execute \"command -bar BuildAll call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.BuildSession')\"\n\
-execute \"command -bar Rebuild call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Rebuild')\"\n\
-execute \"command -bar RebuildProject call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Rebuild')\"\n\
-execute \"command -bar RebuildAll call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.RebuildSession')\"\n\
-execute \"command -bar Clean call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Clean')\"\n\
-execute \"command -bar CleanProject call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Clean')\"\n\
-execute \"command -bar CleanAll call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.CleanSession')\"\n\
-execute \"command -bar Deploy call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Deploy')\"\n\
-execute \"command -bar DeployProject call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Deploy')\"\n\
-execute \"command -bar DeployAll call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.DeploySession')\"\n\
-execute \"command -bar Run call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Run')\"\n\
-execute \"command -bar Debug call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Debug')\"\n\
-execute \"command -bar DebugStart call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Debug')\"\n\
-execute \"command -bar DebugContinue call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.Continue')\"\n\
-execute \"command -bar QMake call rpcnotify(%1, 'Gui', 'triggerCommand', 'Qt4Builder.RunQMake')\"\n\
-execute \"command -bar Target call rpcnotify(%1, 'Gui', 'triggerCommand', 'ProjectExplorer.SelectTargetQuick')\"\n\
-\
-execute \"autocmd BufReadCmd * :call rpcnotify(%1, 'Gui', 'fileAutoCommand', 'BufReadCmd', expand('<abuf>'), expand('<afile>:p'), &buftype, &buflisted, &bufhidden, g:QNVIM_always_text)\"\n\
-execute \"autocmd TermOpen * :call rpcnotify(%1, 'Gui', 'fileAutoCommand', 'TermOpen', expand('<abuf>'), expand('<afile>:p'), &buftype, &buflisted, &bufhidden, g:QNVIM_always_text)\"\n\
-execute \"autocmd BufWriteCmd * :call rpcnotify(%1, 'Gui', 'fileAutoCommand', 'BufWriteCmd', expand('<abuf>'), expand('<afile>:p'), &buftype, &buflisted, &bufhidden, g:QNVIM_always_text)|set nomodified\"\n\
-execute \"autocmd BufEnter * nested :call rpcnotify(%1, 'Gui', 'fileAutoCommand', 'BufEnter', expand('<abuf>'), expand('<afile>:p'), &buftype, &buflisted, &bufhidden, g:QNVIM_always_text)\"\n\
-execute \"autocmd BufDelete * nested :call rpcnotify(%1, 'Gui', 'fileAutoCommand', 'BufDelete', expand('<abuf>'), expand('<afile>:p'), &buftype, &buflisted, &bufhidden, g:QNVIM_always_text)\"\n\
-execute \"autocmd BufHidden * nested :call rpcnotify(%1, 'Gui', 'fileAutoCommand', 'BufHidden', expand('<abuf>'), expand('<afile>:p'), &buftype, &buflisted, &bufhidden, g:QNVIM_always_text)\"\n\
-execute \"autocmd BufWipeout * nested :call rpcnotify(%1, 'Gui', 'fileAutoCommand', 'BufWipeout', expand('<abuf>'), expand('<afile>:p'), &buftype, &buflisted, &bufhidden, g:QNVIM_always_text)\"\n\
-execute \"autocmd FileType help set modifiable|read <afile>|set nomodifiable\"\n\
-\
-function! SetCursor(line, col)\n\
-    call cursor(a:line, a:col)\n\
-    if mode()[0] ==# 'i' or mode()[0] ==# 'R'\n\
-        normal! i\x07u\x03\n\
-    endif\n\
-    call cursor(a:line, a:col)\n\
-endfunction\n\
-autocmd VimEnter * let $MYQVIMRC=substitute(substitute($MYVIMRC, 'init.vim$', 'qnvim.vim', 'g'), 'init.lua$', 'qnvim.vim', 'g') | source $MYQVIMRC")
-                                                      .arg(mNVim->channel()).toUtf8());
-        connect(mNVim->api2(), &NeovimQt::NeovimApi2::neovimNotification,
-                this, &QNVimCore::handleNotification);
-
-        QVariantMap options;
-        options.insert("ext_popupmenu", true);
-        options.insert("ext_tabline", false);
-        options.insert("ext_cmdline", true);
-        options.insert("ext_wildmenu", true);
-        options.insert("ext_messages", true);
-        options.insert("ext_multigrid", true);
-        options.insert("ext_hlstate", true);
-        options.insert("rgb", true);
-        NeovimQt::MsgpackRequest *request = mNVim->api2()->nvim_ui_attach(mWidth, mHeight, options);
-        request->setTimeout(10000);
-        connect(request, &NeovimQt::MsgpackRequest::timeout, mNVim, &NeovimQt::NeovimConnector::fatalTimeout);
-        connect(request, &NeovimQt::MsgpackRequest::timeout, [=]() {
-            qCritical(Main) << "Neovim: Connection timed out!";
-        });
-        connect(request, &NeovimQt::MsgpackRequest::finished, this, [=]() {
-            qInfo(Main) << "Neovim: attached!";
 
-            auto pCurrentEditor = Core::EditorManager::currentEditor();
-            if (pCurrentEditor)
-                QNVimCore::editorOpened(pCurrentEditor);
-        });
+    mStandbyTimer.setSingleShot(true);
+    connect(&mStandbyTimer, &QTimer::timeout, this, &QNVimCore::standbyExpired);
+
+    mUnloadTimer.setInterval(UnloadCheckMsec);
+    connect(&mUnloadTimer, &QTimer::timeout, this, &QNVimCore::unloadInactiveBuffers);
+
+    // Neovim is spawned when the first text editor is activated, see editorOpened()
+}
+
+void QNVimCore::startNeovim() {
+    auto &stats = LatencyStats::instance();
+    stats.beginStartup();
+
+    const QString runtime = installRuntime();
+    QStringList arguments{"--cmd", "let g:QNVIM=1"};
+    if (!runtime.isEmpty()) {
+        arguments << "--cmd" << QStringLiteral("lua package.loaded.qnvim = dofile([==[%1]==])").arg(runtime)
+                  << "--cmd" << QStringLiteral("lua require('qnvim').setup({large_file_size = %1, terminal_scrollback = %2, standby_timeout = %3, shadow_budget = %4, unload_timeout = %5})")
+                                    .arg(mLargeFileSize)
+                                    .arg(mTerminal.scrollback())
+                                    .arg(mStandbyTimeout)
+                                    .arg(mRegistry.budget())
+                                    .arg(mUnloadTimeout);
+    }
+
+    mNVim = new NeovimClient(arguments);
+    stats.markStartup(LatencyStats::Spawn);
+    connect(mNVim, &NeovimClient::notification, this, &QNVimCore::handleNotification);
+    connect(mNVim, &NeovimClient::redraw, this, &QNVimCore::handleRedraw);
+
+    connect(mNVim, &NeovimClient::ready, this, [=]() {
+        LatencyStats::instance().markStartup(LatencyStats::Ready);
+
+        // Otherwise the UI is attached, when QNVim is turned on
+        if (mEnabled)
+            attachUi();
+
+        mNVim->call(&NeovimQt::NeovimApi2::nvim_subscribe, "Gui");
+        mNVim->call(&NeovimQt::NeovimApi2::nvim_subscribe, "api-buffer-updates");
+    });
+}
 
-        mNVim->api2()->nvim_subscribe("Gui");
-        mNVim->api2()->nvim_subscribe("api-buffer-updates");
+void QNVimCore::attachUi() {
+    QVariantMap options;
+    options.insert("ext_popupmenu", true);
+    options.insert("ext_tabline", false);
+    options.insert("ext_cmdline", true);
+    options.insert("ext_wildmenu", true);
+    options.insert("ext_messages", true);
+    options.insert("ext_multigrid", true);
+    options.insert("ext_hlstate", true);
+    options.insert("rgb", true);
+    NeovimReply *request = mNVim->call(&NeovimQt::NeovimApi2::nvim_ui_attach, mWidth, mHeight, options);
+    request->setTimeout(10000);
+    connect(request, &NeovimReply::timeout, mNVim, &NeovimClient::fatalTimeout);
+    connect(request, &NeovimReply::timeout, [=]() {
+        qCritical(Main) << "Neovim: Connection timed out!";
+    });
+    connect(request, &NeovimReply::finished, this, [=]() {
+        qInfo(Main) << "Neovim: attached!";
+        LatencyStats::instance().markStartup(LatencyStats::UiAttach);
+
+        // QNVim was turned off meanwhile and the UI is detached already
+        if (!mEnabled)
+            return;
+
+        reconcileBuffers();
+
+        auto pCurrentEditor = Core::EditorManager::currentEditor();
+        if (pCurrentEditor)
+            QNVimCore::editorOpened(pCurrentEditor);
+
+        preloadOpenEditors();
+        mUnloadTimer.start();
     });
 }
 
+void QNVimCore::setEnabled(bool enabled) {
+    if (enabled == mEnabled)
+        return;
+
+    mEnabled = enabled;
+    if (mEnabled)
+        resume();
+    else
+        suspend();
+}
+
+bool QNVimCore::isEnabled() const {
+    return mEnabled;
+}
+
+void QNVimCore::suspend() {
+    qDebug(Main) << "QNVimCore::suspend";
+
+    qobject_cast<QWidget *>(mCMDLine->parentWidget()->children()[2])->show();
+    mCMDLine->hide();
+
+    disconnect(QApplication::styleHints(), &QStyleHints::cursorFlashTimeChanged,
+               this, &QNVimCore::saveCursorFlashTime);
+    QApplication::setCursorFlashTime(mSavedCursorFlashTime);
+
+    mNumbersColumn->setEditor(nullptr);
+    mTerminal.detach();
+    mTerminalBuffer = 0;
+    mPreloader.clear();
+    mUnloadTimer.stop();
+    for (const auto &highlighter : std::as_const(mHighlighters))
+        delete highlighter;
+    mHighlighters.clear();
+
+    for (Core::IEditor *editor : std::as_const(mEditors)) {
+        auto textEditor = editor ? qobject_cast<TextEditor::TextEditorWidget *>(editor->widget()) : nullptr;
+        if (!textEditor)
+            continue;
+
+        textEditor->setCursorWidth(1);
+        textEditor->removeEventFilter(this);
+    }
+
+    // Requests are handled in order, so a pending attach is undone too
+    if (mNVim and mNVim->isReady())
+        mNVim->call(&NeovimQt::NeovimApi2::nvim_ui_detach);
+
+    // There is nothing to keep, if Neovim hasn't been started yet
+    mStandbyTimer.start(mNVim ? qMax(0, mStandbyTimeout) * 1000 : 0);
+}
+
+void QNVimCore::resume() {
+    qDebug(Main) << "QNVimCore::resume";
+    mStandbyTimer.stop();
+
+    qobject_cast<QWidget *>(mCMDLine->parentWidget()->children()[2])->hide();
+    mCMDLine->show();
+    saveCursorFlashTime(QApplication::cursorFlashTime());
+
+    // Neovim attaches its UI once it's ready
+    if (!mNVim or !mNVim->isReady()) {
+        if (auto editor = Core::EditorManager::currentEditor())
+            editorOpened(editor);
+        return;
+    }
+
+    attachUi();
+}
+
+void QNVimCore::reconcileBuffers() {
+    // Qt Creator owns the documents in standby, only the changed ones are sent
+    for (auto it = mEditors.cbegin(); it != mEditors.cend(); ++it) {
+        const QString bufferType = mRegistry.type(it.key());
+        if (!bufferType.isEmpty() and bufferType != "acwrite")
+            continue;
+
+        auto textEditor = it.value() ? qobject_cast<TextEditor::TextEditorWidget *>(it.value()->widget()) : nullptr;
+        if (!textEditor)
+            continue;
+
+        if (mRegistry.syncedRevision(it.key()) != textEditor->document()->revision()) {
+            qDebug(Buffer) << "Reconciling buffer" << it.key();
+            syncToVim(it.value());
+        }
+
+        updateHighlighter(it.key());
+    }
+}
+
 QNVimCore::~QNVimCore()
 {
     qobject_cast<QWidget *>(mCMDLine->parentWidget()->children()[2])->show();
@@ -160,11 +288,9 @@ QNVimCore::~QNVimCore()
     QApplication::setCursorFlashTime(mSavedCursorFlashTime);
 
     mNumbersColumn->deleteLater();
-    auto request = mNVim->api2()->nvim_command("q!");
-    connect(request, &NeovimQt::MsgpackRequest::finished, this, [=]() {
-        mNVim->deleteLater();
-        mNVim = nullptr;
-    });
+    // The command is sent before the connection is closed
+    if (mNVim)
+        mNVim->call(&NeovimQt::NeovimApi2::nvim_command, "q!");
     disconnect(Core::EditorManager::instance(), &Core::EditorManager::editorAboutToClose,
                this, &QNVimCore::editorAboutToClose);
     disconnect(Core::EditorManager::instance(), &Core::EditorManager::currentEditorChanged,
@@ -188,8 +314,16 @@ QNVimCore::~QNVimCore()
         mEditors.remove(key);
     }
     mBuffers.clear();
-    mChangedTicks.clear();
-    mBufferType.clear();
+    mRegistry.clear();
+    mAttachedBuffers.clear();
+    mFetchScheduler.clear();
+    mFetchCallbacks.clear();
+    mPushScheduler.clear();
+    mChangeTrackers.clear();
+    mEchoes.clear();
+    for (const auto &highlighter : std::as_const(mHighlighters))
+        delete highlighter;
+    mHighlighters.clear();
 
     if (mNVim)
         mNVim->deleteLater();
@@ -214,7 +348,7 @@ void QNVimCore::fixSize(Core::IEditor *editor) {
         return;
     }
 
-    if (!mNVim or !mNVim->isReady())
+    if (!mEnabled or !mNVim or !mNVim->isReady())
         return;
 
     auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
@@ -226,7 +360,7 @@ void QNVimCore::fixSize(Core::IEditor *editor) {
     const int height = qFloor(textEditor->height() / fm.lineSpacing());
 
     if (width != mWidth or height != mHeight)
-        mNVim->api6()->nvim_ui_try_resize_grid(1, width, height);
+        mNVim->call(&NeovimQt::NeovimApi6::nvim_ui_try_resize_grid, 1, width, height);
 }
 
 void QNVimCore::syncCursorToVim(Core::IEditor *editor) {
@@ -242,18 +376,14 @@ void QNVimCore::syncCursorToVim(Core::IEditor *editor) {
         textEditor->textCursor().position() != textEditor->textCursor().anchor())
         return;
 
-    const auto text = textEditor->toPlainText();
-    int cursorPosition = textEditor->textCursor().position();
-    int line = QStringView(text).left(cursorPosition).count('\n') + 1;
-    int col = text.left(cursorPosition).section('\n', -1).toUtf8().length() + 1;
+    const QPoint cursor = vimPosition(textEditor->document(), textEditor->textCursor().position());
 
-    if (line == mCursor.y() and col == mCursor.x()) {
+    if (cursor == mCursor) {
         return;
     }
 
-    mCursor.setY(line);
-    mCursor.setX(col);
-    mNVim->api2()->nvim_command(QStringLiteral("buffer %1|call SetCursor(%2,%3)").arg(mBuffers[editor]).arg(line).arg(col).toUtf8());
+    mCursor = cursor;
+    mNVim->call(&NeovimQt::NeovimApi2::nvim_command, QStringLiteral("buffer %1|lua require('qnvim').set_cursor(%2,%3)").arg(mBuffers[editor]).arg(cursor.y()).arg(cursor.x()).toUtf8());
 }
 
 void QNVimCore::syncSelectionToVim(Core::IEditor *editor) {
@@ -264,10 +394,10 @@ void QNVimCore::syncSelectionToVim(Core::IEditor *editor) {
         return;
 
     auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
-    QString text = textEditor->toPlainText();
+    auto document = textEditor->document();
 
     auto mtc = textEditor->multiTextCursor();
-    int line, col, vLine, vCol;
+    QPoint cursor, vCursor;
 
     QString visualCommand;
     if (mtc.hasMultipleCursors()) {
@@ -286,23 +416,21 @@ void QNVimCore::syncSelectionToVim(Core::IEditor *editor) {
         auto lastCursor = mainCursor == *mtc.begin() ? *(mtc.end() - 1) : *mtc.begin();
         auto nvimAnchor = lastCursor.anchor();
 
-        line = QStringView(text).left(nvimPos).count('\n') + 1;
-        col = text.left(nvimPos).section('\n', -1).length() + 1;
-        vLine = QStringView(text).left(nvimAnchor).count('\n') + 1;
-        vCol = text.left(nvimAnchor).section('\n', -1).length() + 1;
+        cursor = charPosition(document, nvimPos);
+        vCursor = charPosition(document, nvimAnchor);
 
-        if (vCol < col)
-            --col;
-        else if (vCol > col)
-            --vCol;
+        if (vCursor.x() < cursor.x())
+            cursor.rx()--;
+        else if (vCursor.x() > cursor.x())
+            vCursor.rx()--;
 
         visualCommand = "\x16";
     } else if (mMode == "V") {
         return;
     } else {
-        auto cursor = textEditor->textCursor();
-        int cursorPosition = cursor.position();
-        int anchorPosition = cursor.anchor();
+        auto textCursor = textEditor->textCursor();
+        int cursorPosition = textCursor.position();
+        int anchorPosition = textCursor.anchor();
 
         if (anchorPosition == cursorPosition)
             return;
@@ -312,27 +440,23 @@ void QNVimCore::syncSelectionToVim(Core::IEditor *editor) {
         else
             --anchorPosition;
 
-        line = QStringView(text).left(cursorPosition).count('\n') + 1;
-        col = text.left(cursorPosition).section('\n', -1).length() + 1;
-        vLine = QStringView(text).left(anchorPosition).count('\n') + 1;
-        vCol = text.left(anchorPosition).section('\n', -1).length() + 1;
+        cursor = charPosition(document, cursorPosition);
+        vCursor = charPosition(document, anchorPosition);
         visualCommand = "v";
     }
 
-    if (line == mCursor.y() and col == mCursor.x() and vLine == mVCursor.y() and vCol == mVCursor.x())
+    if (cursor == mCursor and vCursor == mVCursor)
         return;
 
-    mCursor.setY(line);
-    mCursor.setX(col);
-    mVCursor.setY(vLine);
-    mVCursor.setX(vCol);
-    mNVim->api2()->nvim_command(QStringLiteral("buffer %1|normal! \x03%3G%4|%2%5G%6|")
-                                    .arg(mBuffers[editor])
-                                    .arg(visualCommand)
-                                    .arg(vLine)
-                                    .arg(vCol)
-                                    .arg(line)
-                                    .arg(col).toUtf8());
+    mCursor = cursor;
+    mVCursor = vCursor;
+    mNVim->call(&NeovimQt::NeovimApi2::nvim_command, QStringLiteral("buffer %1|normal! \x03%3G%4|%2%5G%6|")
+                                                         .arg(mBuffers[editor])
+                                                         .arg(visualCommand)
+                                                         .arg(vCursor.y())
+                                                         .arg(vCursor.x())
+                                                         .arg(cursor.y())
+                                                         .arg(cursor.x()).toUtf8());
 }
 
 void QNVimCore::syncCursorFromVim(const QVariantList &pos, const QVariantList &vPos, QByteArray mode) {
@@ -341,13 +465,13 @@ void QNVimCore::syncCursorFromVim(const QVariantList &pos, const QVariantList &v
         return;
 
     auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
+    auto document = textEditor->document();
+
     int line = pos[0].toInt();
-    int col = pos[1].toInt();
-    col = QString::fromUtf8(mText.section('\n', line - 1, line - 1).toUtf8().left(col - 1)).length() + 1;
+    int col = charColumn(document, line, pos[1].toInt());
 
     int vLine = vPos[0].toInt();
-    int vCol = vPos[1].toInt();
-    vCol = QString::fromUtf8(mText.section('\n', vLine - 1, vLine - 1).toUtf8().left(vCol)).length();
+    int vCol = charColumn(document, vLine, vPos[1].toInt());
 
     mMode = mode;
     mCursor.setY(line);
@@ -355,15 +479,15 @@ void QNVimCore::syncCursorFromVim(const QVariantList &pos, const QVariantList &v
     mVCursor.setY(vLine);
     mVCursor.setX(vCol);
 
-    int anchor = QString("\n" + mText).section('\n', 0, vLine - 1).length() + vCol - 1;
-    int position = QString("\n" + mText).section('\n', 0, line - 1).length() + col - 1;
+    int anchor = lineStart(document, vLine) + vCol - 1;
+    int position = lineStart(document, line) + col - 1;
     if (mMode == "V") {
         if (anchor < position) {
-            anchor = QString("\n" + mText).section('\n', 0, vLine - 1).length();
-            position = QString("\n" + mText).section('\n', 0, line).length() - 1;
+            anchor = lineStart(document, vLine);
+            position = lineEnd(document, line);
         } else {
-            anchor = QString("\n" + mText).section('\n', 0, vLine).length() - 1;
-            position = QString("\n" + mText).section('\n', 0, line - 1).length();
+            anchor = lineEnd(document, vLine);
+            position = lineStart(document, line);
         }
 
         QTextCursor cursor = textEditor->textCursor();
@@ -384,6 +508,15 @@ void QNVimCore::syncCursorFromVim(const QVariantList &pos, const QVariantList &v
         cursor.setPosition(anchor);
         cursor.setPosition(position, QTextCursor::KeepAnchor);
 
+        if (textEditor->textCursor().anchor() != cursor.anchor() or
+            textEditor->textCursor().position() != cursor.position())
+            textEditor->setTextCursor(cursor);
+    } else if (mMode == "\x16" and isLargeFile(document)) {
+        // A cursor per line is too expensive here, so the block is shown as a plain selection
+        QTextCursor cursor = textEditor->textCursor();
+        cursor.setPosition(anchor);
+        cursor.setPosition(anchor > position ? position : position + 1, QTextCursor::KeepAnchor);
+
         if (textEditor->textCursor().anchor() != cursor.anchor() or
             textEditor->textCursor().position() != cursor.position())
             textEditor->setTextCursor(cursor);
@@ -393,7 +526,6 @@ void QNVimCore::syncCursorFromVim(const QVariantList &pos, const QVariantList &v
         else
             ++position;
 
-        auto document = textEditor->textCursor().document();
         const auto& tabs = textEditor->textDocument()->tabSettings();
 
         const auto firstBlock = document->findBlock(anchor);
@@ -452,145 +584,500 @@ void QNVimCore::syncToVim(Core::IEditor *editor, std::function<void()> callback)
         return;
 
     auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
-    QString text = textEditor->toPlainText();
-    int cursorPosition = textEditor->textCursor().position();
-    int line = QStringView(text).left(cursorPosition).count('\n') + 1;
-    int col = text.left(cursorPosition).section('\n', -1).toUtf8().length() + 1;
-
-    if (mText != text) {
-        int bufferNumber = mBuffers[editor];
-        auto request = mNVim->api2()->nvim_buf_set_lines(bufferNumber, 0, -1, true, text.toUtf8().split('\n'));
-        connect(request, &NeovimQt::MsgpackRequest::finished, this, [=]() {
-            connect(mNVim->api2()->nvim_command(QStringLiteral("call cursor(%1,%2)").arg(line).arg(col).toUtf8()),
-                    &NeovimQt::MsgpackRequest::finished, [=]() {
-                        if (callback)
-                            callback();
-                    });
+    auto document = textEditor->document();
+
+    int bufferNumber = mBuffers[editor];
+    if (mChangeTrackers.contains(bufferNumber))
+        mChangeTrackers[bufferNumber].reset();
+
+    if (mRegistry.syncedRevision(bufferNumber) != document->revision() and isLargeFile(document)) {
+        // Changes made during the stream are sent after it
+        const bool ownsPush = mPushScheduler.request(bufferNumber);
+        streamToVim(bufferNumber, 0, [=]() {
+            if (ownsPush and mPushScheduler.finish(bufferNumber))
+                sendChangesToVim(bufferNumber);
+
+            // The user may have switched editors during the stream
+            sendCursor(bufferNumber, editor);
+            if (callback)
+                callback();
         });
+    } else if (mRegistry.syncedRevision(bufferNumber) != document->revision()) {
+        const QStringList lines = document->toPlainText().split('\n');
+        mRegistry.setSyncedRevision(bufferNumber, document->revision());
+
+        auto moveCursor = [=]() {
+            NeovimReply *request = sendCursor(bufferNumber, editor);
+            if (!request) {
+                if (callback)
+                    callback();
+                return;
+            }
+
+            connect(request, &NeovimReply::finished, [=]() {
+                if (callback)
+                    callback();
+            });
+        };
+
+        // With a shadow only the lines, that differ from Neovim's, are sent
+        const auto span = mRegistry.sync(bufferNumber, lines);
+        if (span.first == span.last and span.first == span.newLast)
+            return moveCursor();
+
+        qint64 bytes = 0;
+        QList<QByteArray> replacement;
+        replacement.reserve(span.newLast - span.first);
+        for (int i = span.first; i < span.newLast; ++i) {
+            replacement << lines[i].toUtf8();
+            bytes += replacement.constLast().size() + 1;
+        }
+
+        auto request = mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_lines, bufferNumber, span.first, span.last, true, replacement);
+        expectEcho(bufferNumber, request, span.first, span.last, replacement.size());
+        trackRoundTrip(request);
+        LatencyStats::instance().record(LatencyStats::SyncBytes, bytes);
+        qDebug(Buffer) << "Synced lines" << span.first << span.last << "of buffer" << bufferNumber
+                       << "as" << replacement.size() << "lines";
+
+        connect(request, &NeovimReply::finished, this, moveCursor);
     } else if (callback)
         callback();
 }
 
+void QNVimCore::streamToVim(int buffer, int firstLine, std::function<void()> callback) {
+    if (!mEditors.contains(buffer))
+        return;
+
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+    auto document = textEditor->document();
+
+    // Shadows of large files would take most of the budget, they are streamed as a whole anyway
+    if (firstLine == 0) {
+        mRegistry.setStreamRevision(buffer, document->revision());
+        mRegistry.dropLines(buffer);
+        if (mChangeTrackers.contains(buffer))
+            mChangeTrackers[buffer].reset();
+    }
+
+    qint64 bytes = 0;
+    QList<QByteArray> lines;
+    QTextBlock block = document->findBlockByNumber(firstLine);
+    for (int i = 0; i < LargeFileChunkLines and block.isValid(); ++i) {
+        lines << block.text().toUtf8();
+        bytes += lines.constLast().size() + 1;
+        block = block.next();
+    }
+    const int nextLine = firstLine + lines.size();
+    const bool last = !block.isValid();
+
+    // The first chunk replaces the whole buffer, the rest are appended to it
+    const int lastLine = firstLine ? firstLine : -1;
+    auto request = mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_lines, buffer, firstLine, lastLine, true, lines);
+    expectEcho(buffer, request, firstLine, lastLine, lines.size());
+    trackRoundTrip(request);
+    LatencyStats::instance().record(LatencyStats::SyncBytes, bytes);
+
+    connect(request, &NeovimReply::finished, this, [=]() {
+        if (!mEditors.contains(buffer))
+            return;
+
+        auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+        const int revision = textEditor->document()->revision();
+
+        // Sent lines don't match the document anymore, so start over
+        if (revision != mRegistry.streamRevision(buffer))
+            return streamToVim(buffer, 0, callback);
+
+        if (!last)
+            return streamToVim(buffer, nextLine, callback);
+
+        qDebug(Buffer) << "Streamed buffer" << buffer << "as" << nextLine << "lines";
+        mRegistry.setStreamRevision(buffer, -1);
+        mRegistry.setSyncedRevision(buffer, revision);
+        if (callback)
+            callback();
+    });
+    connect(request, &NeovimReply::error, this, [=](const QVariant &error) {
+        qCritical(Buffer) << "Streaming buffer" << buffer << "failed:" << error;
+        mRegistry.setStreamRevision(buffer, -1);
+        if (callback)
+            callback();
+    });
+}
+
+void QNVimCore::syncChangesToVim(int buffer) {
+    if (!mEditors.contains(buffer) or !mChangeTrackers.contains(buffer) or mChangeTrackers[buffer].isEmpty())
+        return;
+
+    // Changes made while another push is in flight keep accumulating in the tracker
+    if (mPushScheduler.request(buffer))
+        sendChangesToVim(buffer);
+}
+
+void QNVimCore::sendChangesToVim(int buffer) {
+    if (!mEditors.contains(buffer) or !mChangeTrackers.contains(buffer) or mChangeTrackers[buffer].isEmpty()) {
+        if (mPushScheduler.finish(buffer))
+            sendChangesToVim(buffer);
+        else if (NeovimHighlighter *highlighter = mHighlighters.value(buffer))
+            highlighter->scheduleUpdate();
+        return;
+    }
+
+    // Line numbers of the document don't match a partially streamed buffer. The stream
+    // starts over after changes anyway, so they are sent as a part of it.
+    if (mRegistry.streamRevision(buffer) >= 0) {
+        while (mPushScheduler.finish(buffer))
+            ;
+        return;
+    }
+
+    const auto change = mChangeTrackers[buffer].take();
+    Core::IEditor *editor = mEditors[buffer];
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
+    mRegistry.setSyncedRevision(buffer, textEditor->document()->revision());
+
+    qint64 bytes = 0;
+    NeovimReply *request = nullptr;
+    if (change.column >= 0) {
+        QVariantList lines;
+        for (const auto &line : change.lines) {
+            lines << line.toUtf8();
+            bytes += lines.constLast().toByteArray().size() + 1;
+        }
+
+        request = mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua, "vim.api.nvim_buf_set_text(...)",
+                              QVariantList{buffer, change.firstLine, change.column,
+                                           change.firstLine, change.column, lines});
+
+        // The line of the insertion is split into the lines of the document
+        QStringList documentLines;
+        QTextBlock block = textEditor->document()->findBlockByNumber(change.firstLine);
+        for (int i = 0; i < change.lines.size() and block.isValid(); ++i, block = block.next())
+            documentLines << block.text();
+        mRegistry.replaceLines(buffer, change.firstLine, change.lastLine, documentLines);
+    } else {
+        QList<QByteArray> lines;
+        for (const auto &line : change.lines) {
+            lines << line.toUtf8();
+            bytes += lines.constLast().size() + 1;
+        }
+
+        request = mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_lines, buffer, change.firstLine, change.lastLine, true, lines);
+        mRegistry.replaceLines(buffer, change.firstLine, change.lastLine, change.lines);
+    }
+    expectEcho(buffer, request, change.firstLine, change.lastLine, change.lines.size());
+    trackRoundTrip(request);
+    LatencyStats::instance().record(LatencyStats::SyncBytes, bytes);
+
+    auto finish = [=]() {
+        if (mPushScheduler.finish(buffer))
+            sendChangesToVim(buffer);
+        else if (NeovimHighlighter *highlighter = mHighlighters.value(buffer))
+            highlighter->scheduleUpdate();
+    };
+    connect(request, &NeovimReply::finished, this, finish);
+    connect(request, &NeovimReply::error, this, finish);
+
+    qDebug(Buffer) << "Sent lines" << change.firstLine << change.lastLine << "of buffer" << buffer
+                   << "as" << change.lines.size() << "lines";
+
+    sendCursor(buffer, editor);
+}
+
 void QNVimCore::syncFromVim() {
     auto editor = Core::EditorManager::currentEditor();
 
     if (!editor or !mBuffers.contains(editor))
         return;
 
+    int bufferNumber = mBuffers[editor];
+    if (mVimBuffer != bufferNumber or mVimCursor.size() < 2 or mVimVisualCursor.size() < 2)
+        return;
+
     auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
-    unsigned long long syncCoutner = ++mSyncCounter;
 
-    auto request = mNVim->api2()->nvim_eval("[bufnr(''), b:changedtick, mode(1), &modified, getpos('.'), getpos('v'), &number, &relativenumber, &wrap]");
-    connect(request, &NeovimQt::MsgpackRequest::finished, this, [=](quint32, quint64, const QVariant &v) {
-        QVariantList state = v.toList();
+    mNumbersColumn->setNumber(mNumber);
+    mNumbersColumn->setEditor(mRelativeNumber and !isLargeFile(textEditor->document()) ? textEditor : nullptr);
 
-        if (mSyncCounter != syncCoutner)
+    if (textEditor->wordWrapMode() != (mWrap ? QTextOption::WrapAnywhere : QTextOption::NoWrap))
+        textEditor->setWordWrapMode(mWrap ? QTextOption::WrapAnywhere : QTextOption::NoWrap);
+
+    auto syncState = [=]() {
+        if (Core::EditorManager::currentEditor() != editor or mVimBuffer != bufferNumber)
             return;
 
-        if (!mBuffers.contains(editor)) {
+        const qint64 start = LatencyStats::now();
+
+        if (textEditor->document()->isModified() != mVimModified)
+            textEditor->document()->setModified(mVimModified);
+
+        // Terminal cursor comes from the grid
+        if (mRegistry.type(bufferNumber) != "terminal")
+            syncCursorFromVim(mVimCursor, mVimVisualCursor, mVimMode);
+
+        auto &stats = LatencyStats::instance();
+        stats.recordSince(LatencyStats::SyncFlush, start);
+
+        // The state is the last thing Neovim sends in response to the keys
+        if (mUnappliedKeyTime) {
+            stats.recordSince(LatencyStats::KeyToState, mUnappliedKeyTime);
+            mUnappliedKeyTime = 0;
+        }
+    };
+
+    // Terminals are rendered from the grid, their lines are never fetched
+    if (mRegistry.type(bufferNumber) == "terminal") {
+        syncState();
+        return;
+    }
+
+    // Buffer updates arrive before the state, so attached buffers
+    // only need a full fetch if some of them were lost
+    if (mVimChangedtick <= mRegistry.changedtick(bufferNumber) or mFetchScheduler.isBusy(bufferNumber)) {
+        syncState();
+        return;
+    }
+
+    qDebug(Main) << "QNVimPlugin::syncFromVim: changedtick gap" << mRegistry.changedtick(bufferNumber) << mVimChangedtick;
+    fetchBuffer(bufferNumber, syncState);
+}
+
+void QNVimCore::updateVimState(const QVariantMap &state) {
+    if (state.contains("buffer"))
+        mVimBuffer = state["buffer"].toInt();
+    if (state.contains("changedtick"))
+        mVimChangedtick = state["changedtick"].toULongLong();
+    if (state.contains("mode"))
+        mVimMode = state["mode"].toByteArray();
+    if (state.contains("modified"))
+        mVimModified = state["modified"].toBool();
+    if (state.contains("cursor"))
+        mVimCursor = state["cursor"].toList();
+    if (state.contains("visual"))
+        mVimVisualCursor = state["visual"].toList();
+    if (state.contains("number"))
+        mNumber = state["number"].toBool();
+    if (state.contains("relativenumber"))
+        mRelativeNumber = state["relativenumber"].toBool();
+    if (state.contains("wrap"))
+        mWrap = state["wrap"].toBool();
+    if (state.contains("large_file_size"))
+        mLargeFileSize = state["large_file_size"].toLongLong();
+    if (state.contains("terminal_scrollback"))
+        mTerminal.setScrollback(state["terminal_scrollback"].toInt());
+    if (state.contains("standby_timeout"))
+        mStandbyTimeout = state["standby_timeout"].toInt();
+    if (state.contains("shadow_budget"))
+        mRegistry.setBudget(state["shadow_budget"].toLongLong());
+    if (state.contains("unload_timeout"))
+        mUnloadTimeout = state["unload_timeout"].toInt();
+    if (state.contains("neovim_highlight") and state["neovim_highlight"].toBool() != mNeovimHighlight) {
+        mNeovimHighlight = state["neovim_highlight"].toBool();
+        for (int buffer : mEditors.keys())
+            updateHighlighter(buffer);
+    }
+
+    // The state may be pushed in the middle of the keys, e.g. by ModeChanged or TextChanged.
+    // Only CursorMoved and CursorMovedI wait for Neovim's typeahead, and there may be keys
+    // it hasn't received yet, so the state is applied once all of them are acknowledged.
+    if (hasTypeahead())
+        mSyncPostponed = true;
+    else
+        syncFromVim();
+}
+
+void QNVimCore::fetchBuffer(int buffer, std::function<void()> callback) {
+    if (callback)
+        mFetchCallbacks[buffer] << callback;
+
+    if (mFetchScheduler.request(buffer))
+        requestBuffer(buffer);
+}
+
+void QNVimCore::requestBuffer(int buffer) {
+    auto finish = [=]() {
+        // Callbacks wait for the follow-up fetch, which has newer contents
+        if (mFetchScheduler.finish(buffer)) {
+            requestBuffer(buffer);
             return;
         }
 
-        int bufferNumber = mBuffers[editor];
-        if (state[0].toString().toLong() != bufferNumber)
+        const auto callbacks = mFetchCallbacks.take(buffer);
+        for (const auto &callback : callbacks)
+            callback();
+    };
+
+    if (mEditors.contains(buffer)) {
+        auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+        if (textEditor and isLargeFile(textEditor->document())) {
+            streamFromVim(buffer, finish);
             return;
+        }
+    }
 
-        unsigned long long changedtick = state[1].toULongLong();
-        QByteArray mode = state[2].toByteArray();
-        bool modified = state[3].toBool();
-        QVariantList pos = state[4].toList().mid(1, 2);
-        QVariantList vPos = state[5].toList().mid(1, 2);
+    // Changedtick and lines are read in one go, so that they match each other
+    auto request = mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua,
+                               "local buffer = ...\n"
+                               "return {vim.api.nvim_buf_get_changedtick(buffer), vim.api.nvim_buf_get_lines(buffer, 0, -1, true)}",
+                               QVariantList{buffer});
+    trackRoundTrip(request);
+    connect(request, &NeovimReply::error, this, finish);
+    connect(request, &NeovimReply::finished, this, [=](const QVariant &v) {
+        if (!mEditors.contains(buffer)) {
+            mFetchScheduler.remove(buffer);
+            mFetchCallbacks.remove(buffer);
+            return;
+        }
 
-        mNumber = state[6].toBool();
-        mRelativeNumber = state[7].toBool();
-        mWrap = state[8].toBool();
-        mNumbersColumn->setNumber(mNumber);
-        mNumbersColumn->setEditor(mRelativeNumber ? textEditor : nullptr);
+        auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+        if (!textEditor)
+            return finish();
+
+        const QVariantList result = v.toList();
+        mRegistry.setChangedtick(buffer, result.value(0).toULongLong());
+
+        qint64 bytes = 0;
+        QStringList lines;
+        const auto linesList = result.value(1).toList();
+        lines.reserve(linesList.size());
+        for (const auto &t : linesList) {
+            const QByteArray line = t.toByteArray();
+            lines << QString::fromUtf8(line);
+            bytes += line.size() + 1;
+        }
+        mRegistry.setLines(buffer, lines);
+
+        qDebug(Buffer) << "Full fetch of buffer" << buffer << linesList.size() << "lines";
+
+        auto &stats = LatencyStats::instance();
+        stats.record(LatencyStats::SyncBytes, bytes);
+        const qint64 start = LatencyStats::now();
 
-        if (textEditor->wordWrapMode() != (mWrap ? QTextOption::WrapAnywhere : QTextOption::NoWrap))
-            textEditor->setWordWrapMode(mWrap ? QTextOption::WrapAnywhere : QTextOption::NoWrap);
+        ++mSettingTextFromVim;
+        replaceText(textEditor->document(), lines);
+        --mSettingTextFromVim;
+        stats.recordSince(LatencyStats::SyncFlush, start);
+        mRegistry.setSyncedRevision(buffer, textEditor->document()->revision());
+
+        finish();
+    });
+}
 
-        if (mChangedTicks.value(bufferNumber, 0) == changedtick) {
-            syncCursorFromVim(pos, vPos, mode);
+void QNVimCore::streamFromVim(int buffer, std::function<void()> finish) {
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+    mRegistry.dropLines(buffer);
+
+    // Visible lines come first, so that they are up to date as soon as possible
+    const int first = qMax(0, textEditor->firstVisibleBlockNumber() - LargeFileMarginLines);
+    const int last = textEditor->lastVisibleBlockNumber() + 1 + LargeFileMarginLines;
+
+    auto request = mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua,
+                               "local buffer, first, last = ...\n"
+                               "local count = vim.api.nvim_buf_line_count(buffer)\n"
+                               "return {vim.api.nvim_buf_get_changedtick(buffer), count,\n"
+                               "        vim.api.nvim_buf_get_lines(buffer, math.min(first, count), math.min(last, count), true)}",
+                               QVariantList{buffer, first, last});
+    trackRoundTrip(request);
+    connect(request, &NeovimReply::error, this, finish);
+    connect(request, &NeovimReply::finished, this, [=](const QVariant &v) {
+        if (!mEditors.contains(buffer)) {
+            mFetchScheduler.remove(buffer);
+            mFetchCallbacks.remove(buffer);
             return;
         }
 
-        mChangedTicks[bufferNumber] = changedtick;
+        auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+        const QVariantList result = v.toList();
+        const auto changedtick = result.value(0).toULongLong();
+        const int lineCount = result.value(1).toInt();
+        const QVariantList window = result.value(2).toList();
 
-        qDebug(Main) << "QNVimPlugin::syncFromVim";
+        QList<QPair<int, int>> ranges;
+        auto addChunks = [&](int from, int to) {
+            for (int line = from; line < to; line += LargeFileChunkLines)
+                ranges << qMakePair(line, qMin(line + LargeFileChunkLines, to));
+        };
 
-        auto request = mNVim->api2()->nvim_buf_get_lines(bufferNumber, 0, -1, true);
-        connect(request, &NeovimQt::MsgpackRequest::finished, this, [=](quint32, quint64, const QVariant &lines) {
-            if (!mBuffers.contains(editor)) {
-                return;
-            }
+        // With equal line counts every chunk can be applied on its own,
+        // otherwise lines are shifted somewhere and chunks have to go from the top
+        if (lineCount == textEditor->document()->blockCount()) {
+            const int windowFirst = qMin(first, lineCount);
+            const int windowLast = windowFirst + window.size();
+            applyChunk(buffer, windowFirst, windowLast, window);
+            addChunks(0, windowFirst);
+            addChunks(windowLast, lineCount);
+        } else {
+            addChunks(0, lineCount);
+            if (ranges.isEmpty())
+                ranges << qMakePair(0, 0);
+            ranges.last().second = -1;
+        }
 
-            mText.clear();
-            auto linesList = lines.toList();
-            for (const auto &t : linesList)
-                mText += QString::fromUtf8(t.toByteArray()) + '\n';
-            mText.chop(1);
-
-            QString oldText = textEditor->toPlainText();
-
-            Utils::Differ differ;
-            auto diff = differ.diff(oldText, mText);
-
-            if (diff.size()) {
-                // Update changed lines and keep track of the cursor position
-                QTextCursor cursor = textEditor->textCursor();
-                int charactersInfrontOfCursor = cursor.position();
-                int newCursorPos = charactersInfrontOfCursor;
-                cursor.beginEditBlock();
-                cursor.movePosition(QTextCursor::Start, QTextCursor::MoveAnchor);
-
-                for (const auto &d : diff) {
-                    switch (d.command) {
-                    case Utils::Diff::Insert: {
-                        // Adjust cursor position if we do work in front of the cursor.
-                        if (charactersInfrontOfCursor > 0) {
-                            const int size = d.text.size();
-                            charactersInfrontOfCursor += size;
-                            newCursorPos += size;
-                        }
-                        cursor.insertText(d.text);
-                        break;
-                    }
+        streamChunks(buffer, changedtick, ranges, finish);
+    });
+}
 
-                    case Utils::Diff::Delete: {
-                        // Adjust cursor position if we do work in front of the cursor.
-                        if (charactersInfrontOfCursor > 0) {
-                            const int size = d.text.size();
-                            charactersInfrontOfCursor -= size;
-                            newCursorPos -= size;
-                            // Cursor was inside the deleted text, so adjust the new cursor position
-                            if (charactersInfrontOfCursor < 0)
-                                newCursorPos -= charactersInfrontOfCursor;
-                        }
-                        cursor.setPosition(cursor.position() + d.text.length(), QTextCursor::KeepAnchor);
-                        cursor.removeSelectedText();
-                        break;
-                    }
+void QNVimCore::streamChunks(int buffer, unsigned long long changedtick, QList<QPair<int, int>> ranges,
+                             std::function<void()> finish) {
+    if (ranges.isEmpty()) {
+        mRegistry.setChangedtick(buffer, changedtick);
+        return finish();
+    }
 
-                    case Utils::Diff::Equal:
-                        // Adjust cursor position
-                        charactersInfrontOfCursor -= d.text.size();
-                        cursor.setPosition(cursor.position() + d.text.length(), QTextCursor::MoveAnchor);
-                        break;
-                    }
-                }
-                cursor.endEditBlock();
-                cursor.setPosition(newCursorPos);
-            }
+    // Negative end is only used for the last chunk and means the rest of the document
+    const auto range = ranges.takeFirst();
+    auto request = mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua,
+                               "local buffer, first, last = ...\n"
+                               "return {vim.api.nvim_buf_get_changedtick(buffer), vim.api.nvim_buf_get_lines(buffer, first, last, true)}",
+                               QVariantList{buffer, range.first, range.second});
+    trackRoundTrip(request);
+    connect(request, &NeovimReply::error, this, finish);
+    connect(request, &NeovimReply::finished, this, [=](const QVariant &v) {
+        if (!mEditors.contains(buffer)) {
+            mFetchScheduler.remove(buffer);
+            mFetchCallbacks.remove(buffer);
+            return;
+        }
 
-            if (textEditor->document()->isModified() != modified)
-                textEditor->document()->setModified(modified);
+        const QVariantList result = v.toList();
 
-            syncCursorFromVim(pos, vPos, mode);
-        });
+        // Buffer has changed in the middle of the stream
+        if (result.value(0).toULongLong() != changedtick)
+            return streamFromVim(buffer, finish);
+
+        applyChunk(buffer, range.first, range.second, result.value(1).toList());
+        streamChunks(buffer, changedtick, ranges, finish);
     });
 }
 
+void QNVimCore::applyChunk(int buffer, int firstLine, int lastLine, const QVariantList &data) {
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+
+    qint64 bytes = 0;
+    QStringList lines;
+    lines.reserve(data.size());
+    for (const auto &line : data) {
+        const QByteArray text = line.toByteArray();
+        lines << QString::fromUtf8(text);
+        bytes += text.size() + 1;
+    }
+
+    auto &stats = LatencyStats::instance();
+    stats.record(LatencyStats::SyncBytes, bytes);
+    const qint64 start = LatencyStats::now();
+
+    ++mSettingTextFromVim;
+    replaceLines(textEditor->document(), firstLine, lastLine, lines);
+    --mSettingTextFromVim;
+    mRegistry.setSyncedRevision(buffer, textEditor->document()->revision());
+    stats.recordSince(LatencyStats::SyncFlush, start);
+}
+
+bool QNVimCore::isLargeFile(const QTextDocument *document) const {
+    return mLargeFileSize > 0 and document->characterCount() > mLargeFileSize;
+}
+
 void QNVimCore::triggerCommand(const QByteArray &commandId) {
     Core::ActionManager::command(commandId.constData())->action()->trigger();
 }
@@ -606,34 +1093,94 @@ void QNVimCore::saveCursorFlashTime(int cursorFlashTime) {
 }
 
 bool QNVimCore::eventFilter(QObject *object, QEvent *event) {
-    /* if (qobject_cast<QLabel *>(object)) */
-    if (qobject_cast<TextEditor::TextEditorWidget *>(object) ||
-        qobject_cast<QPlainTextEdit *>(object)) {
-        if (event->type() == QEvent::Resize) {
-            QTimer::singleShot(100, this, [=]() { fixSize(); });
-            return false;
-        }
-    }
-
-    if (event->type() == QEvent::KeyPress) {
+    // Filtered widgets receive lots of events, so only look at the ones we need
+    switch (event->type()) {
+    case QEvent::KeyPress: {
         QKeyEvent *keyEvent = static_cast<QKeyEvent *>(event);
-        QString key = NeovimQt::Input::convertKey(*keyEvent);
-        mNVim->api2()->nvim_input(key.toUtf8());
+        queueInput(NeovimQt::Input::convertKey(*keyEvent).toUtf8());
         return true;
-    } else if (event->type() == QEvent::ShortcutOverride) {
+    }
+    case QEvent::ShortcutOverride: {
         QKeyEvent *keyEvent = static_cast<QKeyEvent *>(event);
-        QString key = NeovimQt::Input::convertKey(*keyEvent);
         if (keyEvent->key() == Qt::Key_Escape) {
-            mNVim->api2()->nvim_input(key.toUtf8());
+            queueInput(NeovimQt::Input::convertKey(*keyEvent).toUtf8());
         } else {
             keyEvent->accept();
         }
         return true;
     }
-    return false;
+    case QEvent::Resize:
+        if (qobject_cast<QPlainTextEdit *>(object))
+            QTimer::singleShot(100, this, [=]() { fixSize(); });
+        return false;
+    default:
+        return false;
+    }
+}
+
+void QNVimCore::queueInput(const QByteArray &keys) {
+    mPreloader.postpone();
+
+    const qint64 now = LatencyStats::now();
+    if (!mUnappliedKeyTime)
+        mUnappliedKeyTime = now;
+
+    // Keys received within one event loop iteration are sent together
+    if (mPendingInput.isEmpty()) {
+        mPendingInputTime = now;
+        QMetaObject::invokeMethod(this, &QNVimCore::flushInput, Qt::QueuedConnection);
+    }
+
+    mPendingInput += keys;
+    ++mPendingKeys;
+}
+
+void QNVimCore::flushInput() {
+    if (mPendingInput.isEmpty() or !mNVim)
+        return;
+
+    // Neovim's current buffer isn't the editor's one yet, keys wait for it to be created
+    if (mCreatingBuffers.contains(Core::EditorManager::currentEditor()))
+        return;
+
+    const int keys = mPendingKeys;
+    mUnacknowledgedKeys += keys;
+
+    auto request = mNVim->call(&NeovimQt::NeovimApi2::nvim_input, mPendingInput);
+    LatencyStats::instance().recordSince(LatencyStats::InputQueue, mPendingInputTime);
+    trackRoundTrip(request);
+    mPendingInput.clear();
+    mPendingKeys = 0;
+
+    auto acknowledge = [=]() {
+        mUnacknowledgedKeys -= keys;
+
+        // Run the sync, that was skipped while Neovim hadn't seen all the keys
+        if (!hasTypeahead() and mSyncPostponed) {
+            mSyncPostponed = false;
+            syncFromVim();
+        }
+    };
+    connect(request, &NeovimReply::finished, this, acknowledge);
+    connect(request, &NeovimReply::error, this, acknowledge);
+}
+
+bool QNVimCore::hasTypeahead() const {
+    return !mPendingInput.isEmpty() or mUnacknowledgedKeys > 0;
+}
+
+void QNVimCore::trackRoundTrip(NeovimReply *request) {
+    const qint64 sent = LatencyStats::now();
+    auto record = [sent]() {
+        LatencyStats::instance().recordSince(LatencyStats::RoundTrip, sent);
+    };
+
+    connect(request, &NeovimReply::finished, this, record);
+    connect(request, &NeovimReply::error, this, record);
 }
 
 void QNVimCore::editorOpened(Core::IEditor *editor) {
+    mPreloader.activated(editor);
     if (!mEnabled)
         return;
 
@@ -641,22 +1188,32 @@ void QNVimCore::editorOpened(Core::IEditor *editor) {
         return;
 
     QString filename(this->filename(editor));
-    mText.clear();
     qDebug(Main) << "Opened " << filename << mSettingBufferFromVim;
 
     QWidget *widget = editor->widget();
     if (!widget)
         return;
 
+    // The editor is opened in Neovim once it's ready
+    if (!mNVim) {
+        if (qobject_cast<TextEditor::TextEditorWidget *>(widget))
+            startNeovim();
+        return;
+    }
+
     auto project = ProjectExplorer::SessionManager::projectForFile(
         Utils::FilePath::fromString(filename));
     qDebug(Main) << project;
     if (project) {
         QString projectDirectory = project->projectDirectory().toString();
         if (!projectDirectory.isEmpty())
-            mNVim->api2()->nvim_command(QStringLiteral("cd %1").arg(projectDirectory).toUtf8());
+            mNVim->call(&NeovimQt::NeovimApi2::nvim_command, QStringLiteral("cd %1").arg(projectDirectory).toUtf8());
     }
 
+    // Only the terminal in the current editor is rendered
+    mTerminal.detach();
+    mTerminalBuffer = 0;
+
     if (!qobject_cast<TextEditor::TextEditorWidget *>(widget)) {
         mNumbersColumn->setEditor(nullptr);
         return;
@@ -664,8 +1221,27 @@ void QNVimCore::editorOpened(Core::IEditor *editor) {
     auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
 
     if (mBuffers.contains(editor)) {
-        if (!mSettingBufferFromVim)
-            mNVim->api2()->nvim_command(QStringLiteral("buffer %1").arg(mBuffers[editor]).toUtf8());
+        // Neovim loads an unloaded buffer again on :buffer, its BufReadCmd sends the document
+        if (!mRegistry.activated(mBuffers[editor]))
+            qDebug(Buffer) << "Reloading buffer" << mBuffers[editor];
+
+        // An evicted shadow is rebuilt from the document, as long as it matches the buffer
+        if (!mRegistry.hasLines(mBuffers[editor]) and isSynced(editor) and !isLargeFile(textEditor->document()))
+            mRegistry.setLines(mBuffers[editor], textEditor->document()->toPlainText().split('\n'));
+
+        if (!mSettingBufferFromVim) {
+            mNVim->call(&NeovimQt::NeovimApi2::nvim_command, QStringLiteral("buffer %1").arg(mBuffers[editor]).toUtf8());
+
+            // Preloaded buffers haven't been shown yet, so they take the cursor of the editor
+            if (mPreloadedBuffers.remove(mBuffers[editor])) {
+                mCursor = QPoint();
+                syncCursorToVim(editor);
+            }
+        }
+        if (mRegistry.type(mBuffers[editor]) == "terminal")
+            attachTerminal(mBuffers[editor]);
+    } else if (mCreatingBuffers.contains(editor)) {
+        // It's being preloaded and is shown once created, keys typed meanwhile are held until then
     } else {
         if (mNVim and mNVim->isReady()) {
             if (mSettingBufferFromVim > 0) {
@@ -673,58 +1249,15 @@ void QNVimCore::editorOpened(Core::IEditor *editor) {
                 mEditors[mSettingBufferFromVim] = editor;
                 initializeBuffer(mSettingBufferFromVim);
             } else {
-                QString f = filename;
-                if (f.contains('\\') or f.contains('\'') or f.contains('"') or f.contains(' ')) {
-                    static const auto regExp = QRegularExpression("[\\\"' ]");
-                    f = '"' + f.replace(regExp, "\\\1") + '"';
-                }
-
-                auto request = mNVim->api2()->nvim_command(QStringLiteral("e %1").arg(f).toUtf8());
-                connect(request, &NeovimQt::MsgpackRequest::finished, this, [=]() {
-                    auto request = mNVim->api2()->nvim_eval(QStringLiteral("bufnr('')").toUtf8());
-                    connect(request, &NeovimQt::MsgpackRequest::finished, this, [=](quint32, quint64, const QVariant &v) {
-                        mBuffers[editor] = v.toInt();
-                        mEditors[v.toInt()] = editor;
-                        initializeBuffer(v.toInt());
-                    });
-                });
+                createBuffer(editor);
             }
         }
 
-        Core::IDocument *document = editor->document();
-
-        connect(document, &Core::IDocument::contentsChanged, this, [=]() {
-                auto buffer = mBuffers[editor];
-                QString bufferType = mBufferType[buffer];
-                if (!mEditors.contains(buffer) or (bufferType != "acwrite" and !bufferType.isEmpty()))
-                    return;
-                syncToVim(editor);
-            },
-            Qt::QueuedConnection);
-        connect(textEditor, &TextEditor::TextEditorWidget::cursorPositionChanged, this, [=]() {
-                if (Core::EditorManager::currentEditor() != editor)
-                    return;
-                QString newText = textEditor->toPlainText();
-                if (newText != mText)
-                    return;
-                syncCursorToVim(editor);
-            },
-            Qt::QueuedConnection);
-        connect(textEditor, &TextEditor::TextEditorWidget::selectionChanged, this, [=]() {
-                if (Core::EditorManager::currentEditor() != editor)
-                    return;
-                QString newText = textEditor->toPlainText();
-                if (newText != mText)
-                    return;
-                syncSelectionToVim(editor);
-            },
-            Qt::QueuedConnection);
-        connect(textEditor->textDocument(), &TextEditor::TextDocument::fontSettingsChanged,
-                this, &QNVimCore::updateCursorSize);
+        connectEditor(editor);
     }
     mSettingBufferFromVim = 0;
 
-    mNumbersColumn->setEditor(textEditor);
+    mNumbersColumn->setEditor(isLargeFile(textEditor->document()) ? nullptr : textEditor);
 
     widget->setAttribute(Qt::WA_KeyCompression, false);
     widget->installEventFilter(this);
@@ -732,43 +1265,534 @@ void QNVimCore::editorOpened(Core::IEditor *editor) {
     QTimer::singleShot(100, this, [=]() { fixSize(editor); });
 }
 
+void QNVimCore::connectEditor(Core::IEditor *editor) {
+    if (mConnectedEditors.contains(editor))
+        return;
+    QList<QMetaObject::Connection> &connections = mConnectedEditors[editor];
+
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
+    connections << connect(textEditor->document(), &QTextDocument::contentsChange, this, [=](int position, int charsRemoved, int charsAdded) {
+        auto buffer = mBuffers.value(editor);
+        if (!mChangeTrackers.contains(buffer))
+            return;
+
+        auto &tracker = mChangeTrackers[buffer];
+        QString bufferType = mRegistry.type(buffer);
+
+        // Neovim already has changes coming from it and it owns special buffers.
+        // Changes made in standby or to an unloaded buffer are sent as a whole later.
+        if (!mEnabled or mSettingTextFromVim or (bufferType != "acwrite" and !bufferType.isEmpty())
+            or !mRegistry.isLoaded(buffer)) {
+            tracker.skipChange();
+            return;
+        }
+
+        // Changes made within one event loop iteration are sent together
+        if (tracker.isEmpty())
+            QMetaObject::invokeMethod(this, [=]() { syncChangesToVim(buffer); }, Qt::QueuedConnection);
+
+        tracker.contentsChange(position, charsRemoved, charsAdded);
+    });
+    connections << connect(textEditor, &TextEditor::TextEditorWidget::cursorPositionChanged, this, [=]() {
+            if (!mEnabled or Core::EditorManager::currentEditor() != editor or !isSynced(editor))
+                return;
+            syncCursorToVim(editor);
+        },
+        Qt::QueuedConnection);
+    connections << connect(textEditor, &TextEditor::TextEditorWidget::selectionChanged, this, [=]() {
+            if (!mEnabled or Core::EditorManager::currentEditor() != editor or !isSynced(editor))
+                return;
+            syncSelectionToVim(editor);
+        },
+        Qt::QueuedConnection);
+    connections << connect(textEditor->textDocument(), &TextEditor::TextDocument::fontSettingsChanged,
+                           this, &QNVimCore::updateCursorSize);
+}
+
 void QNVimCore::editorAboutToClose(Core::IEditor *editor) {
     qDebug(Main) << "QNVimPlugin::editorAboutToClose";
     if (!mBuffers.contains(editor))
-        return;
+        return forgetEditor(editor);
 
     if (Core::EditorManager::currentEditor() == editor)
         mNumbersColumn->setEditor(nullptr);
 
     int bufferNumber = mBuffers[editor];
-    mNVim->api2()->nvim_command(QStringLiteral("bd! %1").arg(mBuffers[editor]).toUtf8());
-    mBuffers.remove(editor);
-    mEditors.remove(bufferNumber);
-    mChangedTicks.remove(bufferNumber);
-    mBufferType.remove(bufferNumber);
+    mNVim->call(&NeovimQt::NeovimApi2::nvim_command, QStringLiteral("bd! %1").arg(bufferNumber).toUtf8());
+    forgetBuffer(bufferNumber);
+}
+
+void QNVimCore::createBuffer(Core::IEditor *editor, bool current, std::function<void()> finished) {
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
+    QTextDocument *document = textEditor->document();
+    const QString filename = this->filename(editor);
+    const bool acwrite = QFile::exists(filename);
+
+    // Large documents are streamed into the created buffer
+    const bool largeFile = isLargeFile(document);
+    const int revision = document->revision();
+    QStringList documentLines;
+    QVariantList lines;
+    if (!largeFile) {
+        qint64 bytes = 0;
+        documentLines = document->toPlainText().split('\n');
+        for (const auto &line : std::as_const(documentLines)) {
+            lines << line.toUtf8();
+            bytes += lines.constLast().toByteArray().size() + 1;
+        }
+        LatencyStats::instance().record(LatencyStats::SyncBytes, bytes);
+    }
+
+    const qint64 start = LatencyStats::now();
+    const QPoint cursor = vimPosition(document, textEditor->textCursor().position());
+    auto request = mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua, "return require('qnvim').create_buffer(...)",
+                               QVariantList{filename.toUtf8(), lines, cursor.y(), cursor.x(), acwrite, current});
+    trackRoundTrip(request);
+    mCreatingBuffers.insert(editor);
+
+    const QPointer<Core::IEditor> guard = editor;
+    connect(request, &NeovimReply::finished, this, [=](const QVariant &v) {
+        mCreatingBuffers.remove(editor);
+        const QVariantList result = v.toList();
+        const int buffer = result.value(0).toInt();
+        const bool created = result.value(1).toBool();
+
+        // A buffer Neovim already had is initialized when its editor is activated.
+        // The preloaded text is outdated, if the document has changed meanwhile.
+        if (!guard or (!current and (!created or document->revision() != revision))) {
+            if (created)
+                mNVim->call(&NeovimQt::NeovimApi2::nvim_command, QStringLiteral("bwipeout! %1").arg(buffer).toUtf8());
+
+            // The editor has been activated meanwhile, so it's opened as usual now
+            if (guard and Core::EditorManager::currentEditor() == editor)
+                editorOpened(editor);
+            else if (guard and created)
+                mPreloader.enqueue(editor);
+
+            if (finished)
+                finished();
+            flushInput();
+            return;
+        }
+
+        mBuffers[editor] = buffer;
+        mEditors[buffer] = editor;
+        if (current)
+            mRegistry.activated(buffer);
+
+        // Neovim already had the buffer, e.g. it was opened there
+        if (!created) {
+            initializeBuffer(buffer);
+            flushInput();
+            return;
+        }
+
+        mRegistry.setType(buffer, acwrite ? "acwrite" : "");
+        mChangeTrackers[buffer] = ChangeTracker(document);
+        if (!largeFile) {
+            mRegistry.setSyncedRevision(buffer, revision);
+            mRegistry.setLines(buffer, documentLines);
+        }
+
+        if (!current) {
+            attachBuffer(buffer);
+            updateHighlighter(buffer);
+
+            // Shown on the first activation, which may have happened meanwhile
+            mPreloadedBuffers.insert(buffer);
+            if (Core::EditorManager::currentEditor() == editor) {
+                editorOpened(editor);
+                flushInput();
+            }
+            if (finished)
+                finished();
+            return;
+        }
+
+        // Changes made since the request are sent as a whole
+        syncToVim(editor, [=]() {
+            attachBuffer(buffer);
+            updateHighlighter(buffer);
+            LatencyStats::instance().recordSince(LatencyStats::BufferOpen, start);
+            LatencyStats::instance().markStartup(LatencyStats::FirstSync);
+            if (finished)
+                finished();
+        });
+        flushInput();
+    });
+    connect(request, &NeovimReply::error, this, [=](const QVariant &error) {
+        qCritical(Buffer) << "Cannot create buffer for" << filename << error;
+        mCreatingBuffers.remove(editor);
+
+        // Keys typed into the editor have no buffer to go to
+        if (guard and Core::EditorManager::currentEditor() == editor) {
+            mPendingInput.clear();
+            mPendingKeys = 0;
+        }
+        if (finished)
+            finished();
+    });
+}
+
+qint64 QNVimCore::preloadBuffer(Core::IEditor *editor, std::function<void()> finished) {
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
+    if (!mEnabled or !mNVim or !mNVim->isReady() or !textEditor or mBuffers.contains(editor)
+        or mCreatingBuffers.contains(editor) or isLargeFile(textEditor->document()))
+        return -1;
+
+    qDebug(Buffer) << "Preloading" << filename(editor);
+    connectEditor(editor);
+    createBuffer(editor, false, finished);
+    return textEditor->document()->characterCount();
+}
+
+void QNVimCore::preloadOpenEditors() {
+    const auto entries = Core::DocumentModel::entries();
+    for (const auto entry : entries) {
+        // Suspended documents of a restored session aren't loaded by Qt Creator either
+        if (!entry->document or entry->isSuspended)
+            continue;
+
+        const auto editors = Core::DocumentModel::editorsForDocument(entry->document);
+        for (auto editor : editors)
+            mPreloader.enqueue(editor);
+    }
+}
+
+void QNVimCore::unloadInactiveBuffers() {
+    if (!mEnabled or !mNVim or !mNVim->isReady())
+        return;
+
+    if (mUnloadTimeout > 0) {
+        const auto buffers = mRegistry.inactiveBuffers(qint64(mUnloadTimeout) * 1000);
+        for (int buffer : buffers) {
+            const QString bufferType = mRegistry.type(buffer);
+            Core::IEditor *editor = mEditors.value(buffer);
+            if (!editor or editor == Core::EditorManager::currentEditor()
+                or !(bufferType.isEmpty() or bufferType == "acwrite"))
+                continue;
+
+            // Modified state comes from Neovim, so unsaved documents keep their buffers
+            if (editor->document()->isModified() or !isSynced(editor) or mPushScheduler.isBusy(buffer)
+                or mFetchScheduler.isBusy(buffer))
+                continue;
+
+            unloadBuffer(buffer);
+        }
+    }
+
+    auto request = mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua,
+                               "return (vim.uv or vim.loop).resident_set_memory()", QVariantList());
+    connect(request, &NeovimReply::finished, this, [](const QVariant &v) {
+        LatencyStats::instance().setNeovimMemory(v.toLongLong());
+    });
+}
+
+void QNVimCore::unloadBuffer(int buffer) {
+    qDebug(Buffer) << "Unloading buffer" << buffer;
+
+    // Mappings stay, the buffer is loaded again from the document on its next activation
+    mNVim->call(&NeovimQt::NeovimApi2::nvim_command, QStringLiteral("bunload! %1").arg(buffer).toUtf8());
+    forgetBuffer(buffer, true);
+}
+
+void QNVimCore::forgetBuffer(int buffer, bool unloaded) {
+    mAttachedBuffers.remove(buffer);
+    mEchoes.remove(buffer);
+    mPreloadedBuffers.remove(buffer);
+    delete mHighlighters.take(buffer);
+    if (unloaded) {
+        mRegistry.setLoaded(buffer, false);
+        mRegistry.invalidate(buffer);
+        mRegistry.dropLines(buffer);
+        return;
+    }
+
+    if (buffer == mTerminalBuffer) {
+        mTerminal.detach();
+        mTerminalBuffer = 0;
+    }
+    mRegistry.remove(buffer);
+    mFetchScheduler.remove(buffer);
+    mFetchCallbacks.remove(buffer);
+    mPushScheduler.remove(buffer);
+    mChangeTrackers.remove(buffer);
+
+    if (Core::IEditor *editor = mEditors.take(buffer)) {
+        mBuffers.remove(editor);
+        forgetEditor(editor);
+    }
+}
+
+void QNVimCore::forgetEditor(Core::IEditor *editor) {
+    mPreloader.remove(editor);
+    mCreatingBuffers.remove(editor);
+
+    // An editor, that stays open, is connected again once it gets a buffer
+    const auto connections = mConnectedEditors.take(editor);
+    for (const auto &connection : connections)
+        disconnect(connection);
 }
 
 void QNVimCore::initializeBuffer(int buffer) {
-    QString bufferType = mBufferType[buffer];
+    QString bufferType = mRegistry.type(buffer);
     if (bufferType == "acwrite" or bufferType.isEmpty()) {
+        auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+        mChangeTrackers[buffer] = ChangeTracker(textEditor->document());
+
         connect(
-            mNVim->api2()->nvim_buf_set_option(buffer, "undolevels", -1),
-            &NeovimQt::MsgpackRequest::finished, this, [=]() {
+            mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_option, buffer, "undolevels", -1),
+            &NeovimReply::finished, this, [=]() {
                 syncToVim(mEditors[buffer], [=]() {
-                    mNVim->api2()->nvim_buf_set_option(buffer, "undolevels", -123456);
-                    mNVim->api2()->nvim_buf_set_option(buffer, "modified", false);
+                    mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_option, buffer, "undolevels", -123456);
+                    mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_option, buffer, "modified", false);
                     if (bufferType.isEmpty() && QFile::exists(filename(mEditors[buffer])))
-                        mNVim->api2()->nvim_buf_set_option(buffer, "buftype", "acwrite");
+                        mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_option, buffer, "buftype", "acwrite");
+                    attachBuffer(buffer);
+                    updateHighlighter(buffer);
+                    LatencyStats::instance().markStartup(LatencyStats::FirstSync);
                 });
             },
             Qt::DirectConnection);
+    } else if (bufferType == "terminal") {
+        attachTerminal(buffer);
     } else {
-        mNVim->api2()->nvim_buf_set_option(buffer, "modified", false);
-        syncFromVim();
+        mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_option, buffer, "modified", false);
+        attachBuffer(buffer);
+        fetchBuffer(buffer, [=]() {
+            LatencyStats::instance().markStartup(LatencyStats::FirstSync);
+            syncFromVim();
+        });
+    }
+}
+
+void QNVimCore::attachBuffer(int buffer) {
+    if (mAttachedBuffers.contains(buffer))
+        return;
+
+    mAttachedBuffers.insert(buffer);
+    mNVim->call(&NeovimQt::NeovimApi6::nvim_buf_attach, buffer, false, QVariantMap());
+
+    // Changes made after this point arrive as nvim_buf_lines_event,
+    // so the current changedtick is the base for detecting gaps
+    auto request = mNVim->call(&NeovimQt::NeovimApi6::nvim_buf_get_changedtick, buffer);
+    connect(request, &NeovimReply::finished, this, [=](const QVariant &v) {
+        if (mEditors.contains(buffer) and !mFetchScheduler.isBusy(buffer))
+            mRegistry.setChangedtick(buffer, v.toULongLong());
+    });
+}
+
+void QNVimCore::attachTerminal(int buffer) {
+    if (!mEditors.contains(buffer) or Core::EditorManager::currentEditor() != mEditors[buffer])
+        return;
+
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+    if (!textEditor)
+        return;
+
+    mTerminal.detach();
+    mTerminalBuffer = buffer;
+
+    // Only the lines, that fit into the scrollback, are fetched, further changes come from the grid
+    auto request = mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua,
+                               "local buffer, limit = ...\n"
+                               "local first = math.max(0, vim.api.nvim_buf_line_count(buffer) - limit)\n"
+                               "return {first, vim.api.nvim_buf_get_lines(buffer, first, -1, true)}",
+                               QVariantList{buffer, mTerminal.scrollback()});
+    connect(request, &NeovimReply::finished, this, [=](const QVariant &v) {
+        if (mTerminalBuffer != buffer or !mEditors.contains(buffer))
+            return;
+
+        const QVariantList result = v.toList();
+        const QVariantList lineData = result.value(1).toList();
+        QStringList lines;
+        lines.reserve(lineData.size());
+        for (const auto &line : lineData)
+            lines << QString::fromUtf8(line.toByteArray());
+
+        ++mSettingTextFromVim;
+        replaceLines(textEditor->document(), 0, -1, lines);
+        --mSettingTextFromVim;
+        mRegistry.setSyncedRevision(buffer, textEditor->document()->revision());
+
+        mTerminal.attach(textEditor, result.value(0).toLongLong());
+
+        // Grids are tracked from now on, so they have to be drawn in full
+        mNVim->call(&NeovimQt::NeovimApi2::nvim_command, "redraw!");
+    });
+}
+
+void QNVimCore::updateHighlighter(int buffer) {
+    const QString bufferType = mRegistry.type(buffer);
+    if (!mNeovimHighlight or !mEditors.contains(buffer) or !(bufferType.isEmpty() or bufferType == "acwrite")) {
+        delete mHighlighters.take(buffer);
+        return;
     }
+
+    if (mHighlighters.value(buffer))
+        return;
+
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+    if (!textEditor)
+        return;
+
+    auto highlighter = new NeovimHighlighter(mNVim, buffer, textEditor, [this, buffer]() {
+        return isSynced(mEditors.value(buffer)) and !mPushScheduler.isBusy(buffer);
+    });
+    mHighlighters[buffer] = highlighter;
+    highlighter->start();
+}
+
+void QNVimCore::expectEcho(int buffer, NeovimReply *request, int firstLine, int lastLine, int lineCount) {
+    const auto id = ++mEchoCounter;
+    mEchoes[buffer] << Echo{id, firstLine, lastLine, lineCount};
+
+    // Lines event is sent before the response, so by then the echo
+    // is either consumed or will never come (e.g. the request failed)
+    auto forget = [=]() {
+        if (!mEchoes.contains(buffer))
+            return;
+
+        mEchoes[buffer].removeIf([=](const Echo &echo) {
+            return echo.id == id;
+        });
+    };
+    connect(request, &NeovimReply::finished, this, forget);
+    connect(request, &NeovimReply::error, this, forget);
+}
+
+bool QNVimCore::takeEcho(int buffer, int firstLine, int lastLine, int lineCount) {
+    if (!mEchoes.contains(buffer) or mEchoes[buffer].isEmpty())
+        return false;
+
+    auto &echoes = mEchoes[buffer];
+    const Echo &echo = echoes.constFirst();
+    if (echo.firstLine != firstLine or echo.lineCount != lineCount or
+        (echo.lastLine >= 0 and echo.lastLine != lastLine))
+        return false;
+
+    echoes.removeFirst();
+    return true;
+}
+
+void QNVimCore::handleBufferEvent(const QByteArray &name, const QVariantList &args) {
+    const int buffer = args.value(0).toInt();
+
+    if (name == "nvim_buf_detach_event") {
+        mAttachedBuffers.remove(buffer);
+        return;
+    }
+
+    // A full fetch is in flight and it already includes this change
+    if (!mEditors.contains(buffer) or mFetchScheduler.isBusy(buffer))
+        return;
+
+    // Changedtick is nil for changes that didn't increment it
+    const QVariant changedtickValue = args.value(1);
+    if (!changedtickValue.isNull()) {
+        const auto changedtick = changedtickValue.toULongLong();
+        const auto lastChangedtick = mRegistry.changedtick(buffer);
+
+        if (lastChangedtick and changedtick != lastChangedtick and changedtick != lastChangedtick + 1) {
+            qDebug(Buffer) << "Changedtick gap in buffer" << buffer << lastChangedtick << changedtick;
+            mRegistry.dropLines(buffer);
+            if (mEnabled) {
+                fetchBuffer(buffer);
+                return;
+            }
+        }
+
+        mRegistry.setChangedtick(buffer, changedtick);
+    }
+
+    // Qt Creator owns the documents in standby, so the buffer is overwritten on resume
+    if (!mEnabled)
+        mRegistry.invalidate(buffer);
+
+    if (name != "nvim_buf_lines_event")
+        return;
+
+    const int firstLine = args.value(2).toInt();
+    const int lastLine = args.value(3).toInt();
+    const auto lineData = args.value(4).toList();
+
+    if (takeEcho(buffer, firstLine, lastLine, lineData.size()))
+        return;
+
+    qint64 bytes = 0;
+    QStringList lines;
+    lines.reserve(lineData.size());
+    for (const auto &line : lineData) {
+        const QByteArray data = line.toByteArray();
+        lines << QString::fromUtf8(data);
+        bytes += data.size() + 1;
+    }
+
+    // The shadow follows Neovim in standby too, so only the lines changed meanwhile are overwritten on resume
+    mRegistry.replaceLines(buffer, firstLine, lastLine, lines);
+
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(mEditors[buffer]->widget());
+    if (!mEnabled or !textEditor)
+        return;
+
+    auto &stats = LatencyStats::instance();
+    stats.record(LatencyStats::SyncBytes, bytes);
+    const qint64 start = LatencyStats::now();
+
+    ++mSettingTextFromVim;
+    replaceLines(textEditor->document(), firstLine, lastLine, lines);
+    --mSettingTextFromVim;
+    stats.recordSince(LatencyStats::SyncFlush, start);
+    mRegistry.setSyncedRevision(buffer, textEditor->document()->revision());
+}
+
+NeovimReply *QNVimCore::sendCursor(int buffer, Core::IEditor *editor) {
+    // The editor may have been closed meanwhile, its buffer tells whether it's still the same one
+    if (!editor or Core::EditorManager::currentEditor() != editor or mBuffers.value(editor) != buffer)
+        return nullptr;
+
+    // Neovim checks the buffer too, as it may not have switched to the buffer of the editor yet
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
+    const QPoint cursor = vimPosition(textEditor->document(), textEditor->textCursor().position());
+    return mNVim->call(&NeovimQt::NeovimApi6::nvim_execute_lua, "require('qnvim').sync_cursor(...)",
+                       QVariantList{buffer, cursor.y(), cursor.x()});
+}
+
+bool QNVimCore::isSynced(Core::IEditor *editor) const {
+    if (!mBuffers.contains(editor))
+        return false;
+
+    // Terminal documents keep their own scrollback, so their lines don't match the buffer
+    const int buffer = mBuffers[editor];
+    if (mRegistry.type(buffer) == "terminal")
+        return false;
+
+    if (mChangeTrackers.contains(buffer) and !mChangeTrackers[buffer].isEmpty())
+        return false;
+
+    auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
+    return textEditor and mRegistry.syncedRevision(buffer) == textEditor->document()->revision();
 }
 
 void QNVimCore::handleNotification(const QByteArray &name, const QVariantList &args) {
+    if (name.startsWith("nvim_buf_")) {
+        handleBufferEvent(name, args);
+        return;
+    }
+
+    if (name == "Gui" and args.value(0).toByteArray() == "state") {
+        updateVimState(args.value(1).toMap());
+        return;
+    }
+
+    if (name == "Gui" and args.value(0).toByteArray() == "highlightChanged") {
+        if (NeovimHighlighter *highlighter = mHighlighters.value(args.value(1).toInt())) {
+            for (const auto &range : args.value(2).toList())
+                highlighter->invalidate(range.toList().value(0).toInt(), range.toList().value(1).toInt());
+        }
+        return;
+    }
+
     auto editor = Core::EditorManager::currentEditor();
 
     if (!editor or !mBuffers.contains(editor))
@@ -790,36 +1814,37 @@ void QNVimCore::handleNotification(const QByteArray &name, const QVariantList &a
             bool alwaysText = methodArgs[6].toInt();
 
             if (cmd == "BufReadCmd" or cmd == "TermOpen") {
-                mBufferType[buffer] = bufferType;
+                mRegistry.setType(buffer, bufferType);
                 if (mEditors.contains(buffer)) {
-                    mText.clear();
+                    // Neovim has read the buffer on its own, so it's sent as a whole
+                    mRegistry.setLoaded(buffer, true);
+                    mRegistry.invalidate(buffer);
+                    mRegistry.dropLines(buffer);
                     initializeBuffer(buffer);
                 } else {
                     if (cmd == "TermOpen")
-                        mNVim->api2()->nvim_command("doautocmd BufEnter");
+                        mNVim->call(&NeovimQt::NeovimApi2::nvim_command, "doautocmd BufEnter");
                 }
             } else if (cmd == "BufWriteCmd") {
                 if (mEditors.contains(buffer)) {
                     QString currentFilename = this->filename(mEditors[buffer]);
                     if (mEditors[buffer]->document()->save(nullptr, Utils::FilePath::fromString(filename))) {
                         if (currentFilename != filename) {
-                            mEditors.remove(buffer);
-                            mChangedTicks.remove(buffer);
-                            mBuffers.remove(editor);
+                            forgetBuffer(buffer);
 
-                            auto request = mNVim->api2()->nvim_buf_set_name(buffer, filename.toUtf8());
-                            connect(request, &NeovimQt::MsgpackRequest::finished, this, [=](quint32, quint64, const QVariant &) {
-                                mNVim->api2()->nvim_command("edit!");
+                            auto request = mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_name, buffer, filename.toUtf8());
+                            connect(request, &NeovimReply::finished, this, [=](const QVariant &) {
+                                mNVim->call(&NeovimQt::NeovimApi2::nvim_command, "edit!");
                             });
                         } else {
-                            mNVim->api2()->nvim_buf_set_option(buffer, "modified", false);
+                            mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_option, buffer, "modified", false);
                         }
                     } else {
-                        mNVim->api2()->nvim_buf_set_option(buffer, "modified", true);
+                        mNVim->call(&NeovimQt::NeovimApi2::nvim_buf_set_option, buffer, "modified", true);
                     }
                 }
             } else if (cmd == "BufEnter") {
-                mBufferType[buffer] = bufferType;
+                mRegistry.setType(buffer, bufferType);
                 [[maybe_unused]] Core::IEditor *e = nullptr;
                 mSettingBufferFromVim = buffer;
                 if (!filename.isEmpty() and filename != this->filename(editor)) {
@@ -866,7 +1891,7 @@ void QNVimCore::handleNotification(const QByteArray &name, const QVariantList &a
                 // if (filename.isEmpty()) {
                 //     // callback();
                 // } else {
-                //     connect(mNVim->api2()->nvim_command("try | silent only! | catch | endtry"), &NeovimQt::MsgpackRequest::finished, callback);
+                //     connect(mNVim->call(&NeovimQt::NeovimApi2::nvim_command, "try | silent only! | catch | endtry"), &NeovimReply::finished, callback);
                 // }
             } else if (cmd == "BufDelete") {
                 if (bufferListed and mEditors.contains(buffer) and mEditors[buffer]) {
@@ -890,175 +1915,121 @@ void QNVimCore::handleNotification(const QByteArray &name, const QVariantList &a
                 }
             }
         }
-    } else if (name == "redraw")
-        redraw(args);
+    }
 }
 
-void QNVimCore::redraw(const QVariantList &args) {
+void QNVimCore::handleRedraw(const QList<Redraw::Event> &events) {
+    auto editor = Core::EditorManager::currentEditor();
+
+    if (!editor or !mBuffers.contains(editor))
+        return;
+
+    const qint64 start = LatencyStats::now();
+    redraw(events);
+    LatencyStats::instance().recordSince(LatencyStats::Redraw, start);
+}
+
+void QNVimCore::redraw(const QList<Redraw::Event> &events) {
     auto editor = Core::EditorManager::currentEditor();
     auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
-    bool shouldSync = false;
-    bool flush = false;
-
-    for (const auto& arg : args) {
-        QVariantList line = arg.toList();
-        QByteArray command = line.first().toByteArray();
-        QVariantList args = line.mid(1).constFirst().toList();
-
-        if (!command.startsWith("msg") and
-            !command.startsWith("cmdline") and command != "flush")
-            shouldSync = true;
-
-        if (command == "flush")
-            flush = true;
-
-        if (command == "win_pos") {
-            qDebug(Main) << line;
-        } else if (command == "win_float_pos") {
-            qDebug(Main) << line;
-        } else if (command == "win_hide") {
-            qDebug(Main) << line;
-        } else if (command == "win_close") {
-            qDebug(Main) << line;
-        } else if (command == "bell") {
-            QApplication::beep();
-        } else if (command == "mode_change") {
-            mUIMode = args.first().toByteArray();
-        } else if (command == "busy_start") {
-            mBusy = true;
-        } else if (command == "busy_stop") {
-            mBusy = false;
-        } else if (command == "mouse_on") {
-            mMouse = true;
-        } else if (command == "mouse_off") {
-            mMouse = false;
-        } else if (command == "grid_resize") {
-            if (line.first().toInt() == 1) {
-                mWidth = args[0].toInt();
-                mHeight = args[1].toInt();
-            }
-        } else if (command == "default_colors_set") {
-            qint64 val = args[0].toLongLong();
-            if (val != -1) {
-                mForegroundColor = QRgb(val);
-                QPalette palette = textEditor->palette();
-                palette.setColor(QPalette::WindowText, mForegroundColor);
-                textEditor->setPalette(palette);
-            }
+    bool flushed = false;
+
+    for (const auto &event : events) {
+        std::visit([&](const auto &e) {
+            using Event = std::decay_t<decltype(e)>;
+
+            if constexpr (std::is_same_v<Event, Redraw::Bell>) {
+                QApplication::beep();
+            } else if constexpr (std::is_same_v<Event, Redraw::Flush>) {
+                flushed = true;
+            } else if constexpr (std::is_same_v<Event, Redraw::ModeChange>) {
+                mUIMode = e.mode;
+                mCMDLine->setMode(e.mode);
+            } else if constexpr (std::is_same_v<Event, Redraw::Busy>) {
+                mBusy = e.busy;
+            } else if constexpr (std::is_same_v<Event, Redraw::Mouse>) {
+                mMouse = e.enabled;
+            } else if constexpr (std::is_same_v<Event, Redraw::GridResize>) {
+                if (e.grid == 1) {
+                    mWidth = e.width;
+                    mHeight = e.height;
+                }
+                mTerminal.resize(e);
+            } else if constexpr (std::is_same_v<Event, Redraw::DefaultColorsSet>) {
+                if (e.foreground != -1) {
+                    mForegroundColor = QRgb(e.foreground);
+                    QPalette palette = textEditor->palette();
+                    palette.setColor(QPalette::WindowText, mForegroundColor);
+                    textEditor->setPalette(palette);
+                }
 
-            val = args[1].toLongLong();
-            if (val != -1) {
-                mBackgroundColor = QRgb(val);
-                QPalette palette = textEditor->palette();
-                palette.setBrush(QPalette::Window, mBackgroundColor);
-                textEditor->setPalette(palette);
-            }
+                if (e.background != -1) {
+                    mBackgroundColor = QRgb(e.background);
+                    QPalette palette = textEditor->palette();
+                    palette.setBrush(QPalette::Window, mBackgroundColor);
+                    textEditor->setPalette(palette);
+                }
 
-            val = args[2].toLongLong();
-            if (val != -1) {
-                mSpecialColor = QRgb(val);
-            }
-        } else if (command == "cmdline_show") {
-            mCMDLineVisible = true;
-            QVariantList contentList = args[0].toList();
-            mCMDLineContent.clear();
-
-            for (const auto& contentItem : contentList)
-                mCMDLineContent += QString::fromUtf8(contentItem.toList()[1].toByteArray());
-
-            mCMDLinePos = args[1].toInt();
-            mCMDLineFirstc = args[2].toString()[0];
-            mCMDLinePrompt = QString::fromUtf8(args[3].toByteArray());
-            mCMDLineIndent = args[4].toInt();
-        } else if (command == "cmdline_pos") {
-            mCMDLinePos = args[0].toInt();
-        } else if (command == "cmdline_hide") {
-            mCMDLineVisible = false;
-        } else if (command == "msg_show") {
-            QVariantList contentList = args[1].toList();
-            mMessageLineDisplay.clear();
-            for (const auto& contentItem : contentList)
-                mMessageLineDisplay += QString::fromUtf8(contentItem.toList()[1].toByteArray());
-        } else if (command == "msg_clear") {
-            mMessageLineDisplay.clear();
-        } else if (command == "msg_history_show") {
-            QVariantList entries = args[1].toList();
-            mMessageLineDisplay.clear();
-
-            for (const auto& entry : entries) {
-                QVariantList contentList = entry.toList()[1].toList();
-
-                for (const auto& contentItem : contentList)
-                    mMessageLineDisplay += QString::fromUtf8(contentItem.toList()[1].toByteArray()) + '\n';
+                if (e.special != -1) {
+                    mSpecialColor = QRgb(e.special);
+                }
+            } else if constexpr (std::is_same_v<Event, Redraw::CmdlineShow>) {
+                mCMDLine->showCmdline(e.firstc, e.prompt, e.indent, e.content, e.pos);
+            } else if constexpr (std::is_same_v<Event, Redraw::CmdlinePos>) {
+                mCMDLine->setCmdlinePos(e.pos);
+            } else if constexpr (std::is_same_v<Event, Redraw::CmdlineHide>) {
+                mCMDLine->hideCmdline();
+            } else if constexpr (std::is_same_v<Event, Redraw::MsgShow>) {
+                mCMDLine->setMessage(e.content);
+            } else if constexpr (std::is_same_v<Event, Redraw::MsgClear>) {
+                mCMDLine->setMessage(QString());
+            } else if constexpr (std::is_same_v<Event, Redraw::MsgHistoryShow>) {
+                mCMDLine->setMessage(e.entries.join('\n'));
+            } else if constexpr (std::is_same_v<Event, Redraw::GridLine>) {
+                mTerminal.put(e);
+            } else if constexpr (std::is_same_v<Event, Redraw::GridScroll>) {
+                mTerminal.scroll(e);
+            } else if constexpr (std::is_same_v<Event, Redraw::GridClear>) {
+                mTerminal.clear(e);
+            } else if constexpr (std::is_same_v<Event, Redraw::GridDestroy>) {
+                mTerminal.destroy(e);
+            } else if constexpr (std::is_same_v<Event, Redraw::GridCursorGoto>) {
+                mTerminal.moveCursor(e);
+            } else if constexpr (std::is_same_v<Event, Redraw::WinViewport>) {
+                mTerminal.setViewport(e);
             }
-        }
+        }, event);
     }
 
-    if (shouldSync and flush)
-        syncFromVim();
+    if (mTerminal.isAttached()) {
+        ++mSettingTextFromVim;
+        mTerminal.flush();
+        --mSettingTextFromVim;
+        mRegistry.setSyncedRevision(mTerminalBuffer, textEditor->document()->revision());
+    }
 
     updateCursorSize();
 
-    QFontMetrics commandLineFontMetric(mCMDLine->font());
-    if (mCMDLineVisible) {
-        QString text = mCMDLineFirstc + mCMDLinePrompt + QString(mCMDLineIndent, ' ') + mCMDLineContent;
-
-        if (mCMDLine->toPlainText() != text)
-            mCMDLine->setPlainText(text);
-
-        static const auto endLineRegExp = QRegularExpression("[\n\r]");
-
-        const auto height = (text.count(endLineRegExp) + 1) * commandLineFontMetric.height();
-        auto width = 0;
-
-        const auto lines = text.split(endLineRegExp);
-        for (const auto& line : lines) {
-            width += commandLineFontMetric.horizontalAdvance(line);
-        }
+    mCMDLine->flush();
 
-        if (mCMDLine->minimumWidth() != qMax(200, qMin(width + 10, 400)))
-            mCMDLine->setMinimumWidth(qMax(200, qMin(width + 10, 400)));
-
-        if (mCMDLine->minimumHeight() != qMax(25, qMin(height + 4, 400))) {
-            mCMDLine->setMinimumHeight(qMax(25, qMin(height + 4, 400)));
-            mCMDLine->parentWidget()->setFixedHeight(qMax(25, qMin(height + 4, 400)));
-            mCMDLine->parentWidget()->parentWidget()->setFixedHeight(qMax(25, qMin(height + 4, 400)));
-            mCMDLine->parentWidget()->parentWidget()->parentWidget()->setFixedHeight(qMax(25, qMin(height + 4, 400)));
-        }
+    // Neovim has processed all keys and drawn their result. If they didn't change the state,
+    // e.g. <Esc> in normal mode or typing into the command line, no state is coming for them.
+    if (flushed and mUnappliedKeyTime and !hasTypeahead() and !mSyncPostponed
+        and !mFetchScheduler.isBusy(mBuffers.value(editor)))
+        mUnappliedKeyTime = 0;
 
+    if (mCMDLine->isCmdlineVisible()) {
         if (!mCMDLine->hasFocus())
             mCMDLine->setFocus();
-
-        QTextCursor cursor = mCMDLine->textCursor();
-        if (cursor.position() != (QString(mCMDLineFirstc + mCMDLinePrompt).length() + mCMDLineIndent + mCMDLinePos)) {
-            cursor.setPosition(QString(mCMDLineFirstc + mCMDLinePrompt).length() + mCMDLineIndent + mCMDLinePos);
-            mCMDLine->setTextCursor(cursor);
-        }
-
-        if (mUIMode == "cmdline_normal") {
-            if (mCMDLine->cursorWidth() != 1)
-                mCMDLine->setCursorWidth(1);
-        } else if (mUIMode == "cmdline_insert") {
-            if (mCMDLine->cursorWidth() != 11)
-                mCMDLine->setCursorWidth(11);
-        }
-    } else {
-        mCMDLine->setPlainText(mMessageLineDisplay);
-
-        if (mCMDLine->hasFocus())
-            textEditor->setFocus();
-
-        auto height = commandLineFontMetric.height();
-        mCMDLine->setMinimumHeight(qMax(25, qMin(height + 4, 400)));
-        mCMDLine->parentWidget()->setFixedHeight(qMax(25, qMin(height + 4, 400)));
-        mCMDLine->parentWidget()->parentWidget()->setFixedHeight(qMax(25, qMin(height + 4, 400)));
-        mCMDLine->parentWidget()->parentWidget()->parentWidget()->setFixedHeight(qMax(25, qMin(height + 4, 400)));
+    } else if (mCMDLine->hasFocus()) {
+        textEditor->setFocus();
     }
-
-    mCMDLine->setToolTip(mCMDLine->toPlainText());
 }
 
 void QNVimCore::updateCursorSize() {
+    if (!mEnabled)
+        return;
+
     auto editor = Core::EditorManager::currentEditor();
     auto textEditor = qobject_cast<TextEditor::TextEditorWidget *>(editor->widget());
     QFontMetricsF textEditorFontMetric(textEditor->textDocument()->fontSettings().font());
@@ -3,13 +3,24 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 
+#include "buffer_preloader.h"
+#include "buffer_registry.h"
+#include "change_tracker.h"
+#include "redraw_events.h"
+#include "sync_scheduler.h"
+#include "terminal_renderer.h"
+
 #include <QColor>
 #include <QMap>
 #include <QObject>
 #include <QPoint>
+#include <QPointer>
+#include <QSet>
+#include <QTimer>
 
 QT_BEGIN_NAMESPACE
 class QPlainTextEdit;
+class QTextDocument;
 QT_END_NAMESPACE
 
 namespace Core {
@@ -20,13 +31,13 @@ namespace ProjectExplorer {
 class Project;
 }
 
-namespace NeovimQt {
-class NeovimConnector;
-}
-
 namespace QNVim {
 namespace Internal {
 
+class CommandLine;
+class NeovimClient;
+class NeovimHighlighter;
+class NeovimReply;
 class NumbersColumn;
 
 /**
@@ -40,6 +51,13 @@ class QNVimCore : public QObject {
 
     bool eventFilter(QObject *object, QEvent *event) override;
 
+    /**
+     * Turning QNVim off detaches the UI, but keeps Neovim with its buffers in standby for
+     * g:QNVIM_standby_timeout seconds. Turning it on again only sends documents changed meanwhile.
+     */
+    void setEnabled(bool);
+    bool isEnabled() const;
+
   protected:
     QString filename(Core::IEditor * = nullptr) const;
 
@@ -48,36 +66,128 @@ class QNVimCore : public QObject {
     void syncSelectionToVim(Core::IEditor * = nullptr);
     void syncModifiedToVim(Core::IEditor * = nullptr);
     void syncToVim(Core::IEditor * = nullptr, std::function<void()> = nullptr);
+    void streamToVim(int, int firstLine, std::function<void()>);
+    void syncChangesToVim(int);
+    void sendChangesToVim(int);
     void syncCursorFromVim(const QVariantList &, const QVariantList &, QByteArray mode);
     void syncFromVim();
+    void fetchBuffer(int, std::function<void()> = nullptr);
+    void requestBuffer(int);
+    void streamFromVim(int, std::function<void()> finish);
+    void streamChunks(int, unsigned long long changedtick, QList<QPair<int, int>>, std::function<void()> finish);
+    void applyChunk(int, int firstLine, int lastLine, const QVariantList &);
+    bool isLargeFile(const QTextDocument *) const;
 
     void triggerCommand(const QByteArray &);
 
+    void queueInput(const QByteArray &);
+    void flushInput();
+    bool hasTypeahead() const;
+
+    void trackRoundTrip(NeovimReply *);
+
   private slots:
     // Save cursor flash time to variable instead of changing real value
     void saveCursorFlashTime(int cursorFlashTime);
 
   private:
+    /**
+     * Lines event Neovim is going to send back for a change made by us.
+     * Negative lastLine matches any.
+     */
+    struct Echo {
+        unsigned long long id;
+        int firstLine;
+        int lastLine;
+        int lineCount;
+    };
+
+    void startNeovim();
+    void attachUi();
+    void suspend();
+    void resume();
+    void reconcileBuffers();
     void editorOpened(Core::IEditor *);
     void editorAboutToClose(Core::IEditor *);
 
+    void connectEditor(Core::IEditor *);
+    void createBuffer(Core::IEditor *, bool current = true, std::function<void()> finished = nullptr);
+    qint64 preloadBuffer(Core::IEditor *, std::function<void()> finished);
+    void preloadOpenEditors();
+    void unloadInactiveBuffers();
+    void unloadBuffer(int);
+    /**
+     * Drops all state kept for the buffer and unmaps it from its editor. An unloaded
+     * buffer only loses the state of Neovim's copy of it and stays mapped.
+     */
+    void forgetBuffer(int, bool unloaded = false);
+    void forgetEditor(Core::IEditor *);
     void initializeBuffer(int);
+    void attachBuffer(int);
+    void attachTerminal(int);
+    void updateHighlighter(int);
+    void expectEcho(int, NeovimReply *, int, int, int);
+    bool takeEcho(int, int, int, int);
+    bool isSynced(Core::IEditor *) const;
+    /**
+     * Sends the cursor of the editor, if it's the current one. Neovim only moves the cursor
+     * of its current window, so nothing is sent for other editors.
+     *
+     * @return the request or nullptr, if nothing was sent
+     */
+    NeovimReply *sendCursor(int, Core::IEditor *);
+    void handleBufferEvent(const QByteArray &, const QVariantList &);
     void handleNotification(const QByteArray &, const QVariantList &);
-    void redraw(const QVariantList &);
+    void updateVimState(const QVariantMap &);
+    void handleRedraw(const QList<Redraw::Event> &);
+    void redraw(const QList<Redraw::Event> &);
     void updateCursorSize();
 
     bool mEnabled = true;
+    // Seconds Neovim is kept after QNVim is turned off
+    int mStandbyTimeout = 300;
+    QTimer mStandbyTimer;
 
-    QPlainTextEdit *mCMDLine = nullptr;
+    CommandLine *mCMDLine = nullptr;
     NumbersColumn *mNumbersColumn = nullptr;
-    NeovimQt::NeovimConnector *mNVim = nullptr;
+    NeovimClient *mNVim = nullptr;
     unsigned mVimChanges = 0;
     QMap<Core::IEditor *, int> mBuffers;
     QMap<int, Core::IEditor *> mEditors;
-    QMap<int, bool> mChangedTicks;
-    QMap<int, QString> mBufferType;
+    // Changedticks, revisions and shadows of the buffers
+    BufferRegistry mRegistry;
+
+    // Seconds a buffer isn't current before it's unloaded in Neovim, 0 keeps buffers loaded
+    int mUnloadTimeout = 600;
+    QTimer mUnloadTimer;
+    static constexpr int UnloadCheckMsec = 30000;
+    QSet<int> mAttachedBuffers;
+    SyncScheduler mFetchScheduler;
+    SyncScheduler mPushScheduler;
+    QMap<int, QList<std::function<void()>>> mFetchCallbacks;
+    QMap<int, ChangeTracker> mChangeTrackers;
+    QMap<int, QList<Echo>> mEchoes;
+    unsigned long long mEchoCounter = 0;
+
+    // Documents with more characters are transferred in chunks of lines
+    qint64 mLargeFileSize = 20 * 1024 * 1024;
+    static constexpr int LargeFileChunkLines = 20000;
+    static constexpr int LargeFileMarginLines = 200;
+
+    // Renders the terminal in the current editor
+    TerminalRenderer mTerminal;
+    int mTerminalBuffer = 0;
+
+    // Buffers of documents, that aren't shown yet, are created in the background
+    BufferPreloader mPreloader;
+    QSet<Core::IEditor *> mCreatingBuffers;
+    QSet<int> mPreloadedBuffers;
+    QMap<Core::IEditor *, QList<QMetaObject::Connection>> mConnectedEditors;
+
+    // Highlighters using Neovim's treesitter captures, if enabled
+    QMap<int, QPointer<NeovimHighlighter>> mHighlighters;
+    bool mNeovimHighlight = false;
 
-    QString mText;
     int mWidth = 80;
     int mHeight = 35;
     QColor mForegroundColor = Qt::black;
@@ -90,26 +200,37 @@ class QNVimCore : public QObject {
     bool mRelativeNumber = true;
     bool mWrap = false;
 
-    bool mCMDLineVisible = false;
-    QString mCMDLineContent;
-    QString mCMDLineDisplay;
-    QString mMessageLineDisplay;
-    int mCMDLinePos;
-    QChar mCMDLineFirstc;
-    QString mCMDLinePrompt;
-    int mCMDLineIndent;
-
     QByteArray mUIMode = "normal";
     QByteArray mMode = "n";
     QPoint mCursor;
     QPoint mVCursor;
 
     int mSettingBufferFromVim = 0;
-    unsigned long long mSyncCounter = 0;
+    int mSettingTextFromVim = 0;
+
+    // Editor state, that Neovim pushes on changes
+    int mVimBuffer = 0;
+    unsigned long long mVimChangedtick = 0;
+    QByteArray mVimMode = "n";
+    bool mVimModified = false;
+    QVariantList mVimCursor;
+    QVariantList mVimVisualCursor;
 
     int mSavedCursorFlashTime = 0;
 
+    QByteArray mPendingInput;
+    int mPendingKeys = 0;
+    int mUnacknowledgedKeys = 0;
+    bool mSyncPostponed = false;
+
+    // LatencyStats::now() of the oldest key in mPendingInput
+    qint64 mPendingInputTime = 0;
+    // LatencyStats::now() of the oldest key, which resulting state isn't applied yet
+    qint64 mUnappliedKeyTime = 0;
+
   signals:
+    // Neovim has been in standby for too long, QNVimCore is supposed to be deleted
+    void standbyExpired();
 };
 
 } // namespace Internal
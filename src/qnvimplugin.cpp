@@ -5,14 +5,19 @@
 #include "qnvimplugin.h"
 
 #include "qnvimcore.h"
+#include "latency_stats.h"
 #include "log.h"
 #include "qnvimconstants.h"
 
 #include <coreplugin/actionmanager/actioncontainer.h>
 #include <coreplugin/actionmanager/actionmanager.h>
+#include <coreplugin/icore.h>
 
 #include <QAction>
+#include <QFileDialog>
+#include <QFontDatabase>
 #include <QMenu>
+#include <QMessageBox>
 
 namespace QNVim {
 namespace Internal {
@@ -33,11 +38,28 @@ bool QNVimPlugin::initialize(const QStringList &arguments, QString *errorString)
     Core::ActionContainer *menu = Core::ActionManager::createMenu(Constants::MENU_ID);
     menu->menu()->setTitle(tr("QNVim"));
     menu->addAction(cmd);
+    menu->addSeparator();
+
+    auto showStatsAction = new QAction(tr("Show Latency Statistics"), this);
+    menu->addAction(Core::ActionManager::registerAction(showStatsAction, Constants::SHOW_STATS_ID,
+                                                        Core::Context(Core::Constants::C_GLOBAL)));
+    connect(showStatsAction, &QAction::triggered, this, &QNVimPlugin::showLatencyStats);
+
+    auto saveStatsAction = new QAction(tr("Save Latency Statistics..."), this);
+    menu->addAction(Core::ActionManager::registerAction(saveStatsAction, Constants::SAVE_STATS_ID,
+                                                        Core::Context(Core::Constants::C_GLOBAL)));
+    connect(saveStatsAction, &QAction::triggered, this, &QNVimPlugin::saveLatencyStats);
+
+    auto resetStatsAction = new QAction(tr("Reset Latency Statistics"), this);
+    menu->addAction(Core::ActionManager::registerAction(resetStatsAction, Constants::RESET_STATS_ID,
+                                                        Core::Context(Core::Constants::C_GLOBAL)));
+    connect(resetStatsAction, &QAction::triggered, this, []() { LatencyStats::instance().reset(); });
+
     Core::ActionManager::actionContainer(Core::Constants::M_TOOLS)->addMenu(menu);
 
     qunsetenv("NVIM_LISTEN_ADDRESS");
 
-    m_core = std::make_unique<QNVimCore>();
+    createCore();
 
     return true;
 }
@@ -66,10 +88,43 @@ bool QNVimPlugin::eventFilter(QObject *object, QEvent *event) {
 void QNVimPlugin::toggleQNVim() {
     qDebug(Main) << "QNVimPlugin::toggleQNVim";
 
+    // Neovim is kept in standby after turning QNVim off
     if (m_core)
-        m_core = nullptr;
+        m_core->setEnabled(!m_core->isEnabled());
     else
-        m_core = std::make_unique<QNVimCore>();
+        createCore();
+}
+
+void QNVimPlugin::createCore() {
+    m_core = std::make_unique<QNVimCore>();
+
+    // Not deleted from its own signal, and QNVim may have been turned on again before the queued call
+    connect(m_core.get(), &QNVimCore::standbyExpired, this, [this]() {
+        if (m_core and !m_core->isEnabled())
+            m_core = nullptr;
+    }, Qt::QueuedConnection);
+}
+
+void QNVimPlugin::showLatencyStats() {
+    QMessageBox box(Core::ICore::dialogParent());
+    box.setWindowTitle(tr("QNVim Latency Statistics"));
+    box.setText(LatencyStats::instance().report());
+    box.setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    box.setTextInteractionFlags(Qt::TextSelectableByMouse);
+    box.exec();
+}
+
+void QNVimPlugin::saveLatencyStats() {
+    const QString fileName = QFileDialog::getSaveFileName(Core::ICore::dialogParent(),
+                                                          tr("Save Latency Statistics"),
+                                                          QString(), tr("Text files (*.txt)"));
+    if (fileName.isEmpty())
+        return;
+
+    QString errorString;
+    if (!LatencyStats::instance().dump(fileName, &errorString))
+        QMessageBox::warning(Core::ICore::dialogParent(), tr("QNVim Latency Statistics"),
+                             tr("Cannot save statistics to %1: %2").arg(fileName, errorString));
 }
 
 HelpEditorFactory::HelpEditorFactory() : PlainTextEditorFactory() {
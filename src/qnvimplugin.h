@@ -26,8 +26,12 @@ class QNVimPlugin : public ExtensionSystem::IPlugin {
     bool eventFilter(QObject *, QEvent *) override;
 
     void toggleQNVim();
+    void showLatencyStats();
+    void saveLatencyStats();
 
   private:
+    void createCore();
+
     std::unique_ptr<QNVimCore> m_core;
 };
 
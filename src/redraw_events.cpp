@@ -0,0 +1,184 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "redraw_events.h"
+
+#include <array>
+#include <string_view>
+
+namespace QNVim {
+namespace Internal {
+namespace Redraw {
+
+namespace {
+
+// Views into decoded msgpack values, that don't copy them
+const QVariantList &list(const QVariant &value) {
+    static const QVariantList empty;
+    if (value.metaType() != QMetaType::fromType<QVariantList>())
+        return empty;
+
+    return *static_cast<const QVariantList *>(value.constData());
+}
+
+const QVariant &at(const QVariantList &args, qsizetype i) {
+    static const QVariant invalid;
+    return i < args.size() ? args.at(i) : invalid;
+}
+
+QString string(const QVariant &value) {
+    return QString::fromUtf8(value.toByteArray());
+}
+
+// Text of [[attr_id, text], ...] chunks
+QString chunks(const QVariant &value) {
+    QString text;
+    for (const QVariant &chunk : list(value))
+        text += string(at(list(chunk), 1));
+
+    return text;
+}
+
+using Parser = Event (*)(const QVariantList &args);
+
+struct Handler {
+    std::string_view name;
+    Parser parse;
+};
+
+constexpr Handler Handlers[] = {
+    {"bell", [](const QVariantList &) -> Event { return Bell{}; }},
+    {"flush", [](const QVariantList &) -> Event { return Flush{}; }},
+    {"mode_change", [](const QVariantList &args) -> Event { return ModeChange{at(args, 0).toByteArray()}; }},
+    {"busy_start", [](const QVariantList &) -> Event { return Busy{true}; }},
+    {"busy_stop", [](const QVariantList &) -> Event { return Busy{false}; }},
+    {"mouse_on", [](const QVariantList &) -> Event { return Mouse{true}; }},
+    {"mouse_off", [](const QVariantList &) -> Event { return Mouse{false}; }},
+    {"grid_resize", [](const QVariantList &args) -> Event {
+         return GridResize{at(args, 0).toLongLong(), at(args, 1).toInt(), at(args, 2).toInt()};
+     }},
+    {"default_colors_set", [](const QVariantList &args) -> Event {
+         return DefaultColorsSet{at(args, 0).toLongLong(), at(args, 1).toLongLong(), at(args, 2).toLongLong()};
+     }},
+    {"cmdline_show", [](const QVariantList &args) -> Event {
+         return CmdlineShow{chunks(at(args, 0)), at(args, 1).toInt(), string(at(args, 2)),
+                            string(at(args, 3)), at(args, 4).toInt()};
+     }},
+    {"cmdline_pos", [](const QVariantList &args) -> Event { return CmdlinePos{at(args, 0).toInt()}; }},
+    {"cmdline_hide", [](const QVariantList &) -> Event { return CmdlineHide{}; }},
+    {"msg_show", [](const QVariantList &args) -> Event { return MsgShow{chunks(at(args, 1))}; }},
+    {"msg_clear", [](const QVariantList &) -> Event { return MsgClear{}; }},
+    {"msg_history_show", [](const QVariantList &args) -> Event {
+         MsgHistoryShow event;
+         for (const QVariant &entry : list(at(args, 0)))
+             event.entries << chunks(at(list(entry), 1));
+         return event;
+     }},
+    {"grid_line", [](const QVariantList &args) -> Event {
+         GridLine event{at(args, 0).toLongLong(), at(args, 1).toInt(), at(args, 2).toInt(), {}};
+
+         // [text, hl_id, repeat], the last two are optional
+         const QVariantList &cells = list(at(args, 3));
+         event.cells.reserve(cells.size());
+         for (const QVariant &cell : cells) {
+             const QVariantList &fields = list(cell);
+             event.cells << GridCell{string(at(fields, 0)), fields.size() > 2 ? fields.at(2).toInt() : 1};
+         }
+         return event;
+     }},
+    {"grid_scroll", [](const QVariantList &args) -> Event {
+         return GridScroll{at(args, 0).toLongLong(), at(args, 1).toInt(), at(args, 2).toInt(),
+                           at(args, 3).toInt(), at(args, 4).toInt(), at(args, 5).toInt()};
+     }},
+    {"grid_clear", [](const QVariantList &args) -> Event { return GridClear{at(args, 0).toLongLong()}; }},
+    {"grid_destroy", [](const QVariantList &args) -> Event { return GridDestroy{at(args, 0).toLongLong()}; }},
+    {"grid_cursor_goto", [](const QVariantList &args) -> Event {
+         return GridCursorGoto{at(args, 0).toLongLong(), at(args, 1).toInt(), at(args, 2).toInt()};
+     }},
+    {"win_viewport", [](const QVariantList &args) -> Event {
+         // [grid, win, topline, botline, curline, curcol, line_count]
+         return WinViewport{at(args, 0).toLongLong(), at(args, 2).toLongLong(), at(args, 6).toLongLong()};
+     }},
+};
+
+constexpr int HandlerCount = sizeof(Handlers) / sizeof(Handlers[0]);
+
+/*
+ * Perfect hash of the handled names: FNV-1a with a seed, that is searched
+ * at compile time so that every name gets its own slot in the table.
+ */
+constexpr quint32 TableSize = 64;
+
+constexpr quint32 hash(std::string_view name, quint32 seed) {
+    quint32 h = 2166136261u ^ seed;
+    for (char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619u;
+    }
+    return h & (TableSize - 1);
+}
+
+constexpr bool isPerfect(quint32 seed) {
+    std::array<bool, TableSize> used{};
+    for (const Handler &handler : Handlers) {
+        const quint32 slot = hash(handler.name, seed);
+        if (used[slot])
+            return false;
+        used[slot] = true;
+    }
+    return true;
+}
+
+constexpr quint32 findSeed() {
+    for (quint32 seed = 0; seed < 1000; ++seed) {
+        if (isPerfect(seed))
+            return seed;
+    }
+    return TableSize;
+}
+
+constexpr quint32 Seed = findSeed();
+static_assert(Seed != TableSize, "No perfect hash of redraw event names, increase TableSize");
+
+constexpr std::array<qint8, TableSize> buildTable() {
+    std::array<qint8, TableSize> table{};
+    for (auto &index : table)
+        index = -1;
+    for (int i = 0; i < HandlerCount; ++i)
+        table[hash(Handlers[i].name, Seed)] = static_cast<qint8>(i);
+    return table;
+}
+
+constexpr std::array<qint8, TableSize> Table = buildTable();
+
+const Handler *findHandler(const QByteArray &name) {
+    const std::string_view view(name.constData(), static_cast<size_t>(name.size()));
+    const int index = Table[hash(view, Seed)];
+    if (index < 0 or Handlers[index].name != view)
+        return nullptr;
+
+    return &Handlers[index];
+}
+
+} // namespace
+
+QList<Event> parse(const QVariantList &args) {
+    QList<Event> events;
+
+    for (const QVariant &item : args) {
+        // [name, [args...], [args...], ...], Neovim batches consecutive calls of the same event
+        const QVariantList &batch = list(item);
+        const Handler *handler = findHandler(at(batch, 0).toByteArray());
+        if (not handler)
+            continue;
+
+        for (qsizetype i = 1; i < batch.size(); ++i)
+            events << handler->parse(list(batch.at(i)));
+    }
+
+    return events;
+}
+
+} // namespace Redraw
+} // namespace Internal
+} // namespace QNVim
@@ -0,0 +1,136 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+
+#include <variant>
+
+namespace QNVim {
+namespace Internal {
+namespace Redraw {
+
+/*
+ * UI events of the "redraw" notification, that the plugin handles.
+ * See :help ui-events for the meaning of the fields.
+ */
+
+struct Bell {
+};
+
+struct Flush {
+};
+
+struct ModeChange {
+    QByteArray mode;
+};
+
+struct Busy {
+    bool busy = false;
+};
+
+struct Mouse {
+    bool enabled = false;
+};
+
+struct GridResize {
+    qint64 grid = 0;
+    int width = 0;
+    int height = 0;
+};
+
+struct DefaultColorsSet {
+    // -1 if the color is not set
+    qint64 foreground = -1;
+    qint64 background = -1;
+    qint64 special = -1;
+};
+
+struct CmdlineShow {
+    QString content;
+    int pos = 0;
+    QString firstc;
+    QString prompt;
+    int indent = 0;
+};
+
+struct CmdlinePos {
+    int pos = 0;
+};
+
+struct CmdlineHide {
+};
+
+struct MsgShow {
+    QString content;
+};
+
+struct MsgClear {
+};
+
+struct MsgHistoryShow {
+    QStringList entries;
+};
+
+struct GridCell {
+    QString text;
+    int repeat = 1;
+};
+
+struct GridLine {
+    qint64 grid = 0;
+    int row = 0;
+    int colStart = 0;
+    QList<GridCell> cells;
+};
+
+struct GridScroll {
+    qint64 grid = 0;
+    int top = 0;
+    int bottom = 0;
+    int left = 0;
+    int right = 0;
+    int rows = 0;
+};
+
+struct GridClear {
+    qint64 grid = 0;
+};
+
+struct GridDestroy {
+    qint64 grid = 0;
+};
+
+struct GridCursorGoto {
+    qint64 grid = 0;
+    int row = 0;
+    int col = 0;
+};
+
+struct WinViewport {
+    qint64 grid = 0;
+    // 0-based buffer line shown in the first row
+    qint64 topline = 0;
+    qint64 lineCount = 0;
+};
+
+using Event = std::variant<Bell, Flush, ModeChange, Busy, Mouse, GridResize, DefaultColorsSet,
+                           CmdlineShow, CmdlinePos, CmdlineHide, MsgShow, MsgClear, MsgHistoryShow,
+                           GridLine, GridScroll, GridClear, GridDestroy, GridCursorGoto, WinViewport>;
+
+/**
+ * Converts arguments of a "redraw" notification to typed events.
+ *
+ * Event names are looked up in a table built at compile time, unhandled events
+ * are skipped without touching their arguments.
+ */
+QList<Event> parse(const QVariantList &args);
+
+} // namespace Redraw
+} // namespace Internal
+} // namespace QNVim
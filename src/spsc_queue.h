@@ -0,0 +1,73 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Unbounded lock-free queue for exactly one producer thread and one consumer thread.
+ *
+ * The queue is a linked list with a dummy head node. The producer only touches the tail
+ * and the consumer only the head, so the link to the next node is the only shared state.
+ */
+template <typename T>
+class SpscQueue {
+  public:
+    SpscQueue()
+        : mHead{new Node}, mTail{mHead} {
+    }
+
+    ~SpscQueue() {
+        while (mHead) {
+            Node *next = mHead->next.load(std::memory_order_relaxed);
+            delete mHead;
+            mHead = next;
+        }
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /**
+     * Called from the producer thread only.
+     */
+    void push(T value) {
+        Node *node = new Node;
+        node->value = std::move(value);
+        mTail->next.store(node, std::memory_order_release);
+        mTail = node;
+    }
+
+    /**
+     * Called from the consumer thread only.
+     *
+     * @return false if the queue is empty
+     */
+    bool pop(T &value) {
+        Node *next = mHead->next.load(std::memory_order_acquire);
+        if (not next)
+            return false;
+
+        value = std::move(next->value);
+        delete mHead;
+        mHead = next;
+        return true;
+    }
+
+  private:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        T value{};
+    };
+
+    Node *mHead;
+    Node *mTail;
+};
+
+} // namespace Internal
+} // namespace QNVim
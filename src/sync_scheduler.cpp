@@ -0,0 +1,48 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "sync_scheduler.h"
+
+namespace QNVim {
+namespace Internal {
+
+bool SyncScheduler::request(int buffer) {
+    auto &state = mStates[buffer];
+
+    if (state.inFlight) {
+        state.dirty = true;
+        return false;
+    }
+
+    state.inFlight = true;
+    return true;
+}
+
+bool SyncScheduler::finish(int buffer) {
+    auto it = mStates.find(buffer);
+    if (it == mStates.end())
+        return false;
+
+    if (it->dirty) {
+        it->dirty = false;
+        return true;
+    }
+
+    mStates.erase(it);
+    return false;
+}
+
+bool SyncScheduler::isBusy(int buffer) const {
+    return mStates.contains(buffer);
+}
+
+void SyncScheduler::remove(int buffer) {
+    mStates.remove(buffer);
+}
+
+void SyncScheduler::clear() {
+    mStates.clear();
+}
+
+} // namespace Internal
+} // namespace QNVim
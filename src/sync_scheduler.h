@@ -0,0 +1,45 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QHash>
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Keeps at most one sync per buffer in flight.
+ * Syncs requested in the meantime collapse into a single follow-up one.
+ */
+class SyncScheduler {
+  public:
+    /**
+     * @return true if the sync should start now, false if it is postponed
+     */
+    bool request(int buffer);
+
+    /**
+     * Marks the running sync as finished.
+     *
+     * @return true if a sync was requested meanwhile and should start now,
+     *         finish() must be called for it as well
+     */
+    bool finish(int buffer);
+
+    bool isBusy(int buffer) const;
+
+    void remove(int buffer);
+    void clear();
+
+  private:
+    struct State {
+        bool inFlight = false;
+        bool dirty = false;
+    };
+
+    QHash<int, State> mStates;
+};
+
+} // namespace Internal
+} // namespace QNVim
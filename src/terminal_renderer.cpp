@@ -0,0 +1,275 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "terminal_renderer.h"
+
+#include <QPlainTextEdit>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+
+namespace QNVim {
+namespace Internal {
+
+TerminalRenderer::TerminalRenderer(int scrollback)
+    : mScrollback{qMax(1, scrollback)} {
+}
+
+void TerminalRenderer::setScrollback(int lines) {
+    mScrollback = qMax(1, lines);
+}
+
+int TerminalRenderer::scrollback() const {
+    return mScrollback;
+}
+
+void TerminalRenderer::attach(QPlainTextEdit *editor, qint64 offset) {
+    mEditor = editor;
+    mOffset = offset;
+
+    // Neovim owns terminal contents, there is nothing to undo
+    mEditor->document()->setUndoRedoEnabled(false);
+
+    // Rows are drawn again after attaching, all of them are going to be dirty
+    for (Grid &grid : mGrids) {
+        grid.flushedTopline = -1;
+        grid.scrolledRows = 0;
+    }
+    mCursorDirty = true;
+}
+
+void TerminalRenderer::detach() {
+    mEditor = nullptr;
+
+    // Geometry of the grids is kept, Neovim doesn't send it again for a redraw
+    for (Grid &grid : mGrids) {
+        grid.dirty.fill(false);
+        grid.flushedTopline = -1;
+        grid.scrolledRows = 0;
+    }
+    mCursorDirty = false;
+}
+
+bool TerminalRenderer::isAttached() const {
+    return not mEditor.isNull();
+}
+
+void TerminalRenderer::resize(const Redraw::GridResize &event) {
+    Grid &grid = mGrids[event.grid];
+    grid.cells.resize(event.height);
+    for (auto &row : grid.cells)
+        row.resize(event.width, QStringLiteral(" "));
+    grid.dirty.resize(event.height, false);
+}
+
+void TerminalRenderer::put(const Redraw::GridLine &event) {
+    if (not mEditor)
+        return;
+
+    auto it = mGrids.find(event.grid);
+    if (it == mGrids.end() or event.row < 0 or event.row >= it->cells.size())
+        return;
+
+    auto &row = it->cells[event.row];
+    int col = event.colStart;
+    for (const auto &cell : event.cells) {
+        for (int i = 0; i < cell.repeat and col < row.size(); ++i)
+            row[col++] = cell.text;
+    }
+
+    it->dirty[event.row] = true;
+}
+
+void TerminalRenderer::scroll(const Redraw::GridScroll &event) {
+    if (not mEditor)
+        return;
+
+    auto it = mGrids.find(event.grid);
+    if (it == mGrids.end())
+        return;
+
+    Grid &grid = *it;
+    const int top = qMax(0, event.top);
+    const int bottom = qMin(int(grid.cells.size()), event.bottom);
+
+    auto moveRow = [&](int to, int from) {
+        for (int col = qMax(0, event.left); col < event.right and col < grid.cells[to].size(); ++col)
+            grid.cells[to][col] = grid.cells[from][col];
+    };
+
+    if (event.rows > 0) {
+        for (int row = top; row + event.rows < bottom; ++row)
+            moveRow(row, row + event.rows);
+    } else {
+        for (int row = bottom - 1; row + event.rows >= top; --row)
+            moveRow(row, row + event.rows);
+    }
+
+    // Rows keep their contents only if the window has scrolled, but
+    // the scroll may also come from lines deleted from the buffer
+    markDirty(grid, top, bottom);
+
+    if (event.left == 0 and event.right >= grid.cells.value(0).size() and top == 0 and bottom == grid.cells.size())
+        grid.scrolledRows += event.rows;
+}
+
+void TerminalRenderer::clear(const Redraw::GridClear &event) {
+    if (not mEditor)
+        return;
+
+    auto it = mGrids.find(event.grid);
+    if (it == mGrids.end())
+        return;
+
+    for (auto &row : it->cells)
+        row.fill(QStringLiteral(" "));
+    markDirty(*it, 0, it->cells.size());
+}
+
+void TerminalRenderer::destroy(const Redraw::GridDestroy &event) {
+    mGrids.remove(event.grid);
+}
+
+void TerminalRenderer::moveCursor(const Redraw::GridCursorGoto &event) {
+    mCursorGrid = event.grid;
+    mCursorRow = event.row;
+    mCursorCol = event.col;
+    mCursorDirty = isAttached();
+}
+
+void TerminalRenderer::setViewport(const Redraw::WinViewport &event) {
+    Grid &grid = mGrids[event.grid];
+    grid.topline = event.topline;
+    grid.lineCount = event.lineCount;
+}
+
+bool TerminalRenderer::flush() {
+    if (not mEditor)
+        return false;
+
+    auto it = mGrids.find(mCursorGrid);
+    if (it == mGrids.end() or it->lineCount < 0)
+        return false;
+
+    Grid &grid = *it;
+    QTextDocument *document = mEditor->document();
+    QTextCursor cursor(document);
+    cursor.beginEditBlock();
+    const int revision = document->revision();
+
+    // When the window scrolls up, but its topline stays, Neovim has dropped the oldest lines
+    // of its scrollback and the buffer lines have moved. The document keeps them.
+    if (grid.flushedTopline >= 0)
+        mOffset -= qMax<qint64>(0, grid.scrolledRows - (grid.topline - grid.flushedTopline));
+    grid.flushedTopline = grid.topline;
+    grid.scrolledRows = 0;
+
+    // Lines, that won't fit into the scrollback, aren't inserted at all
+    const qint64 first = grid.lineCount - mScrollback;
+    if (first > mOffset) {
+        removeFirstLines(cursor, first - mOffset);
+        mOffset = first;
+    }
+
+    // New lines are appended as is, the visible ones are filled from the grid below
+    const qint64 appended = grid.lineCount - (mOffset + document->blockCount());
+    if (appended > 0) {
+        cursor.movePosition(QTextCursor::End);
+        cursor.insertText(QString(appended, '\n'));
+    }
+
+    if (document->blockCount() > mScrollback) {
+        const int count = document->blockCount() - mScrollback;
+        removeFirstLines(cursor, count);
+        mOffset += count;
+    }
+
+    for (int row = 0; row < grid.dirty.size(); ++row) {
+        if (not grid.dirty[row])
+            continue;
+        grid.dirty[row] = false;
+
+        const qint64 line = grid.topline + row;
+        if (line >= grid.lineCount)
+            continue;
+
+        QTextBlock block = document->findBlockByNumber(int(line - mOffset));
+        const QString text = rowText(grid, row);
+        if (not block.isValid() or block.text() == text)
+            continue;
+
+        cursor.setPosition(block.position());
+        cursor.setPosition(block.position() + block.length() - 1, QTextCursor::KeepAnchor);
+        cursor.insertText(text);
+    }
+
+    cursor.endEditBlock();
+
+    if (mCursorDirty) {
+        mCursorDirty = false;
+
+        const QTextBlock block = document->findBlockByNumber(int(grid.topline + mCursorRow - mOffset));
+        if (block.isValid()) {
+            const int position = block.position() + qMin(rowColumn(grid, mCursorRow, mCursorCol), block.length() - 1);
+            if (mEditor->textCursor().position() != position or mEditor->textCursor().hasSelection()) {
+                QTextCursor textCursor = mEditor->textCursor();
+                textCursor.setPosition(position);
+                mEditor->setTextCursor(textCursor);
+            }
+        }
+    }
+
+    return document->revision() != revision;
+}
+
+void TerminalRenderer::markDirty(Grid &grid, int first, int last) {
+    for (int row = qMax(0, first); row < last and row < grid.dirty.size(); ++row)
+        grid.dirty[row] = true;
+}
+
+QString TerminalRenderer::rowText(const Grid &grid, int row) const {
+    const auto &cells = grid.cells[row];
+
+    // Terminal buffers don't keep trailing spaces of the screen
+    int end = cells.size();
+    while (end > 0 and cells[end - 1] == QStringLiteral(" "))
+        --end;
+
+    QString text;
+    text.reserve(end);
+    for (int col = 0; col < end; ++col)
+        text += cells[col];
+
+    return text;
+}
+
+int TerminalRenderer::rowColumn(const Grid &grid, int row, int col) const {
+    if (row < 0 or row >= grid.cells.size())
+        return 0;
+
+    // Right halves of double width characters are empty cells
+    int column = 0;
+    const auto &cells = grid.cells[row];
+    for (int i = 0; i < col and i < cells.size(); ++i)
+        column += cells[i].size();
+
+    return column;
+}
+
+void TerminalRenderer::removeFirstLines(QTextCursor &cursor, qint64 count) {
+    QTextDocument *document = cursor.document();
+    cursor.movePosition(QTextCursor::Start);
+
+    if (count >= document->blockCount()) {
+        // Removing the text leaves an empty line, that stands for the first kept one
+        cursor.movePosition(QTextCursor::End, QTextCursor::KeepAnchor);
+        cursor.removeSelectedText();
+        return;
+    }
+
+    cursor.setPosition(document->findBlockByNumber(int(count)).position(), QTextCursor::KeepAnchor);
+    cursor.removeSelectedText();
+}
+
+} // namespace Internal
+} // namespace QNVim
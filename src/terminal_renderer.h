@@ -0,0 +1,95 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "redraw_events.h"
+
+#include <QHash>
+#include <QPointer>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QPlainTextEdit;
+class QTextCursor;
+QT_END_NAMESPACE
+
+namespace QNVim {
+namespace Internal {
+
+/**
+ * Renders a terminal buffer from the grid of its window instead of syncing buffer lines.
+ *
+ * The document holds the tail of the buffer: lines scrolled out of the terminal stay in it
+ * as scrollback, new lines are appended, and the oldest ones are dropped when there are
+ * more than the scrollback limit, so memory is capped for long-running terminals. Only the
+ * rows Neovim has redrawn are written to the document, nothing is fetched or diffed.
+ */
+class TerminalRenderer {
+  public:
+    explicit TerminalRenderer(int scrollback = 10000);
+
+    /**
+     * Lines kept in the document.
+     */
+    void setScrollback(int lines);
+    int scrollback() const;
+
+    /**
+     * Starts rendering to the editor, which document contains buffer lines from @p offset.
+     */
+    void attach(QPlainTextEdit *editor, qint64 offset);
+    void detach();
+    bool isAttached() const;
+
+    /**
+     * Geometry of the grids and the cursor are tracked even while detached,
+     * the contents of the rows only while attached.
+     */
+    void resize(const Redraw::GridResize &);
+    void put(const Redraw::GridLine &);
+    void scroll(const Redraw::GridScroll &);
+    void clear(const Redraw::GridClear &);
+    void destroy(const Redraw::GridDestroy &);
+    void moveCursor(const Redraw::GridCursorGoto &);
+    void setViewport(const Redraw::WinViewport &);
+
+    /**
+     * Writes changes of the terminal grid to the document.
+     *
+     * @return true if the document was modified
+     */
+    bool flush();
+
+  private:
+    struct Grid {
+        QVector<QVector<QString>> cells;
+        QVector<bool> dirty;
+        qint64 topline = 0;
+        qint64 lineCount = -1;
+        // Topline at the last flush and rows scrolled up since then
+        qint64 flushedTopline = -1;
+        int scrolledRows = 0;
+    };
+
+    void markDirty(Grid &, int first, int last);
+    QString rowText(const Grid &, int row) const;
+    int rowColumn(const Grid &, int row, int col) const;
+    void removeFirstLines(QTextCursor &, qint64 count);
+
+    QPointer<QPlainTextEdit> mEditor;
+    int mScrollback;
+    // Buffer line of the first line in the document. It's negative when the document keeps
+    // lines, that Neovim has already dropped from its own scrollback.
+    qint64 mOffset = 0;
+
+    QHash<qint64, Grid> mGrids;
+    // Grid of the current window, which is the one showing the terminal
+    qint64 mCursorGrid = 0;
+    int mCursorRow = 0;
+    int mCursorCol = 0;
+    bool mCursorDirty = false;
+};
+
+} // namespace Internal
+} // namespace QNVim
@@ -0,0 +1,167 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "text_position.h"
+
+#include "utf_columns.h"
+
+#include <QPointer>
+#include <QTextBlock>
+#include <QTextDocument>
+
+namespace QNVim {
+namespace Internal {
+
+namespace {
+
+QTextBlock blockForLine(const QTextDocument *document, int line) {
+    QTextBlock block = document->findBlockByNumber(line - 1);
+    if (!block.isValid())
+        block = line < 1 ? document->firstBlock() : document->lastBlock();
+
+    return block;
+}
+
+// Lines longer than that are converted from the closest checkpoint of their column index
+constexpr int LongLine = 64 * 1024;
+
+// Characters [from, to) of the block, without copying the rest of it
+QString blockText(const QTextBlock &block, int from, int to) {
+    const QTextDocument *document = block.document();
+    QString text(qMax(0, to - from), Qt::Uninitialized);
+    QChar *data = text.data();
+    for (int i = from; i < to; ++i)
+        *data++ = document->characterAt(block.position() + i);
+
+    return text;
+}
+
+/*
+ * Column index of the last long line, that was converted. It's usually the one with
+ * the cursor, so it follows the edits of the document instead of being rebuilt.
+ */
+struct IndexedLine {
+    QPointer<const QTextDocument> document;
+    QMetaObject::Connection connection;
+    // Revision the index matches, it may have been built during the change already
+    int revision = -1;
+    int position = -1;
+    int length = -1;
+    ColumnIndex index;
+
+    void contentsChange(int changePosition, int removed, int added) {
+        if (position < 0)
+            return;
+
+        // Revision only changes with undo enabled, without it the index is built again
+        if (not document->isUndoRedoEnabled()) {
+            position = -1;
+            return;
+        }
+
+        // Formats don't change the revision, e.g. the ones of highlighter
+        if (document->revision() == revision)
+            return;
+        revision = document->revision();
+
+        // Position of the line break, removing it joins the line with the next one
+        const int end = position + length - 1;
+        if (changePosition > end)
+            return;
+
+        if (changePosition + removed < position) {
+            position += added - removed;
+            return;
+        }
+
+        // Inserted line breaks split the line, so its length wouldn't match
+        const QTextBlock block = document->findBlock(position);
+        if (changePosition >= position and changePosition + removed <= end and block.position() == position
+            and block.length() == length + added - removed) {
+            length = block.length();
+            index.replace(changePosition - position, removed, added, [&](qsizetype from, qsizetype to) {
+                return blockText(block, int(from), int(to));
+            });
+            return;
+        }
+
+        position = -1;
+    }
+};
+
+const ColumnIndex *columnIndex(const QTextBlock &block) {
+    if (block.length() <= LongLine)
+        return nullptr;
+
+    // Positions are converted in the GUI thread only
+    static IndexedLine line;
+
+    const QTextDocument *document = block.document();
+    if (line.document != document) {
+        QObject::disconnect(line.connection);
+        line.document = document;
+        line.connection = QObject::connect(document, &QTextDocument::contentsChange, document,
+                                           [](int position, int removed, int added) {
+                                               line.contentsChange(position, removed, added);
+                                           });
+        line.position = -1;
+    }
+
+    if (line.position != block.position() or line.length != block.length()) {
+        line.revision = document->revision();
+        line.position = block.position();
+        line.length = block.length();
+        line.index = ColumnIndex(block.text());
+    }
+
+    return &line.index;
+}
+
+} // namespace
+
+int lineStart(const QTextDocument *document, int line) {
+    return blockForLine(document, line).position();
+}
+
+int lineEnd(const QTextDocument *document, int line) {
+    const QTextBlock block = blockForLine(document, line);
+    return block.position() + block.length() - 1;
+}
+
+int charColumn(const QTextDocument *document, int line, int byteColumn) {
+    const QTextBlock block = blockForLine(document, line);
+    const int bytes = byteColumn - 1;
+
+    if (const ColumnIndex *index = columnIndex(block)) {
+        const ColumnIndex::Checkpoint checkpoint = index->checkpointForBytes(bytes);
+        // One unit past the next checkpoint tells, whether the offset is inside a pair
+        const int to = qMin(int(checkpoint.utf16 + ColumnIndex::ChunkSize) + 2, block.length() - 1);
+        const QString chunk = blockText(block, checkpoint.utf16, to);
+        return int(checkpoint.utf16 + utf16Length(chunk, bytes - checkpoint.utf8)) + 1;
+    }
+
+    return int(utf16Length(block.text(), bytes)) + 1;
+}
+
+QPoint vimPosition(const QTextDocument *document, int position) {
+    const QTextBlock block = document->findBlock(position);
+    const int column = position - block.position();
+
+    qsizetype bytes = 0;
+    if (const ColumnIndex *index = columnIndex(block)) {
+        const ColumnIndex::Checkpoint checkpoint = index->checkpoint(column);
+        bytes = checkpoint.utf8 + utf8Length(blockText(block, checkpoint.utf16, column));
+    } else {
+        bytes = utf8Length(QStringView(block.text()).left(column));
+    }
+
+    return {int(bytes) + 1, block.blockNumber() + 1};
+}
+
+QPoint charPosition(const QTextDocument *document, int position) {
+    const QTextBlock block = document->findBlock(position);
+    return {position - block.position() + 1, block.blockNumber() + 1};
+}
+
+} // namespace Internal
+} // namespace QNVim
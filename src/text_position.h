@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QPoint>
+
+QT_BEGIN_NAMESPACE
+class QTextDocument;
+QT_END_NAMESPACE
+
+namespace QNVim {
+namespace Internal {
+
+/*
+ * Conversions between Qt positions and Vim (line, column) pairs.
+ *
+ * Lines are looked up in the block map of QTextDocument, which is a balanced tree
+ * of block lengths the document updates incrementally on every edit, so lookups
+ * are O(log n) and only the text of the line in question is touched. Columns are
+ * counted in place, see utf_columns.h, and within very long lines only from the
+ * closest checkpoint of the line.
+ *
+ * Lines and columns are 1-based, points store the column in x and the line in y.
+ */
+
+/**
+ * Position of the first character of the line.
+ */
+int lineStart(const QTextDocument *, int line);
+
+/**
+ * Position right after the last character of the line.
+ */
+int lineEnd(const QTextDocument *, int line);
+
+/**
+ * Converts byte column (as Vim reports it) to UTF-16 column of the same character.
+ */
+int charColumn(const QTextDocument *, int line, int byteColumn);
+
+/**
+ * Line and byte column of the position.
+ */
+QPoint vimPosition(const QTextDocument *, int position);
+
+/**
+ * Line and UTF-16 column of the position.
+ */
+QPoint charPosition(const QTextDocument *, int position);
+
+} // namespace Internal
+} // namespace QNVim
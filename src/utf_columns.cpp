@@ -0,0 +1,186 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#include "utf_columns.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define QNVIM_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace QNVim {
+namespace Internal {
+
+namespace {
+
+int utf8Bytes(char16_t unit) {
+    if (unit < 0x80)
+        return 1;
+    if (unit < 0x800 or QChar::isSurrogate(unit))
+        return 2;
+    return 3;
+}
+
+#ifdef QNVIM_SSE2
+constexpr qsizetype Lanes = 8;
+
+// Lanes of the counts don't overflow in that many blocks, as each one adds at least -3
+constexpr qsizetype MaxBlocks = 8192;
+
+/*
+ * A unit takes 3 + a + b + s bytes, where a is -1 for units below 0x80, b for units
+ * below 0x800 and s for surrogates, otherwise they are 0. The sum of the masks is
+ * returned, comparisons are unsigned thanks to the saturating subtraction.
+ */
+__m128i byteMasks(const char16_t *units) {
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(units));
+    const __m128i zero = _mm_setzero_si128();
+
+    const __m128i ascii = _mm_cmpeq_epi16(_mm_subs_epu16(data, _mm_set1_epi16(0x7f)), zero);
+    const __m128i twoBytes = _mm_cmpeq_epi16(_mm_subs_epu16(data, _mm_set1_epi16(0x7ff)), zero);
+    const __m128i surrogate = _mm_cmpeq_epi16(_mm_and_si128(data, _mm_set1_epi16(short(0xf800))),
+                                              _mm_set1_epi16(short(0xd800)));
+
+    return _mm_add_epi16(_mm_add_epi16(ascii, twoBytes), surrogate);
+}
+
+int horizontalSum(__m128i lanes) {
+    __m128i sum = _mm_madd_epi16(lanes, _mm_set1_epi16(1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+#endif
+
+} // namespace
+
+qsizetype utf8Length(QStringView text) {
+    const char16_t *units = text.utf16();
+    const qsizetype size = text.size();
+    qsizetype bytes = 0;
+    qsizetype i = 0;
+
+#ifdef QNVIM_SSE2
+    while (size - i >= Lanes) {
+        const qsizetype blocks = qMin((size - i) / Lanes, MaxBlocks);
+        __m128i masks = _mm_setzero_si128();
+        for (qsizetype block = 0; block < blocks; ++block, i += Lanes)
+            masks = _mm_add_epi16(masks, byteMasks(units + i));
+
+        bytes += 3 * blocks * Lanes + horizontalSum(masks);
+    }
+#endif
+
+    for (; i < size; ++i)
+        bytes += utf8Bytes(units[i]);
+
+    return bytes;
+}
+
+qsizetype utf16Length(QStringView text, qsizetype bytes) {
+    const char16_t *units = text.utf16();
+    const qsizetype size = text.size();
+    qsizetype total = 0;
+    qsizetype i = 0;
+
+#ifdef QNVIM_SSE2
+    // Whole blocks are skipped, the one with the offset is counted unit by unit
+    while (size - i >= Lanes) {
+        const qsizetype next = total + 3 * Lanes + horizontalSum(byteMasks(units + i));
+        if (next > bytes)
+            break;
+
+        total = next;
+        i += Lanes;
+    }
+#endif
+
+    while (i < size and total < bytes)
+        total += utf8Bytes(units[i++]);
+
+    // An offset between the halves of a pair points into the character as well
+    if (i > 0 and i < size and QChar::isHighSurrogate(units[i - 1]) and QChar::isLowSurrogate(units[i]))
+        ++i;
+
+    return i;
+}
+
+ColumnIndex::ColumnIndex(QStringView line)
+    : mLength{line.size()} {
+    mCheckpoints.reserve(line.size() / ChunkSize + 1);
+    mCheckpoints << Checkpoint();
+    index(line, Checkpoint(), mCheckpoints);
+}
+
+void ColumnIndex::replace(qsizetype column, qsizetype removed, qsizetype added, const TextSource &text) {
+    // Chunk of the edit lies between the last checkpoint before it and the first one after it
+    const qsizetype first = std::upper_bound(mCheckpoints.cbegin(), mCheckpoints.cend(), column,
+                                             [](qsizetype column, const Checkpoint &checkpoint) {
+                                                 return column < checkpoint.utf16;
+                                             }) - mCheckpoints.cbegin() - 1;
+    qsizetype last = first + 1;
+    while (last < mCheckpoints.size() and mCheckpoints[last].utf16 < column + removed)
+        ++last;
+
+    const qsizetype delta = added - removed;
+    const Checkpoint start = mCheckpoints[first];
+    const qsizetype end = (last < mCheckpoints.size() ? mCheckpoints[last].utf16 : mLength) + delta;
+
+    QList<Checkpoint> checkpoints;
+    const Checkpoint chunkEnd = index(text(start.utf16, end), start, checkpoints);
+
+    // Text after the chunk hasn't changed, so its checkpoints only move
+    if (last < mCheckpoints.size()) {
+        const qsizetype bytes = chunkEnd.utf8 - mCheckpoints[last].utf8;
+        for (qsizetype i = last; i < mCheckpoints.size(); ++i) {
+            mCheckpoints[i].utf16 += delta;
+            mCheckpoints[i].utf8 += bytes;
+        }
+    }
+
+    mCheckpoints.remove(first + 1, last - first - 1);
+    mCheckpoints.insert(first + 1, checkpoints.size(), Checkpoint());
+    std::copy(checkpoints.cbegin(), checkpoints.cend(), mCheckpoints.begin() + first + 1);
+    mLength += delta;
+}
+
+ColumnIndex::Checkpoint ColumnIndex::checkpoint(qsizetype utf16Column) const {
+    const auto it = std::upper_bound(mCheckpoints.cbegin(), mCheckpoints.cend(), utf16Column,
+                                     [](qsizetype column, const Checkpoint &checkpoint) {
+                                         return column < checkpoint.utf16;
+                                     });
+    return it == mCheckpoints.cbegin() ? Checkpoint() : *(it - 1);
+}
+
+ColumnIndex::Checkpoint ColumnIndex::checkpointForBytes(qsizetype utf8Column) const {
+    const auto it = std::upper_bound(mCheckpoints.cbegin(), mCheckpoints.cend(), utf8Column,
+                                     [](qsizetype column, const Checkpoint &checkpoint) {
+                                         return column < checkpoint.utf8;
+                                     });
+    return it == mCheckpoints.cbegin() ? Checkpoint() : *(it - 1);
+}
+
+ColumnIndex::Checkpoint ColumnIndex::index(QStringView text, Checkpoint start, QList<Checkpoint> &checkpoints) {
+    Checkpoint checkpoint = start;
+    qsizetype offset = 0;
+    while (text.size() - offset > ChunkSize) {
+        // Pairs aren't split, so that every checkpoint is a character boundary
+        qsizetype next = offset + ChunkSize;
+        if (text[next].isLowSurrogate() and text[next - 1].isHighSurrogate())
+            ++next;
+
+        checkpoint.utf8 += utf8Length(text.sliced(offset, next - offset));
+        checkpoint.utf16 = start.utf16 + next;
+        checkpoints << checkpoint;
+        offset = next;
+    }
+
+    checkpoint.utf8 += utf8Length(text.sliced(offset));
+    checkpoint.utf16 = start.utf16 + text.size();
+    return checkpoint;
+}
+
+} // namespace Internal
+} // namespace QNVim
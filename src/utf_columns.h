@@ -0,0 +1,90 @@
+// SPDX-FileCopyrightText: 2023 Mikhail Zolotukhin <mail@gikari.com>
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <QList>
+#include <QString>
+#include <QStringView>
+
+#include <functional>
+
+namespace QNVim {
+namespace Internal {
+
+/*
+ * Conversions between UTF-16 columns of Qt and byte columns of Vim, that count
+ * without transcoding the text. Both directions are vectorized with SSE2 where
+ * it's available and fall back to a scalar loop elsewhere.
+ *
+ * A surrogate pair takes 4 bytes, as in UTF-8. Unpaired surrogates take 2 bytes
+ * each, they don't appear in text, that came from Neovim.
+ */
+
+/**
+ * Bytes the text takes in UTF-8.
+ */
+qsizetype utf8Length(QStringView text);
+
+/**
+ * UTF-16 length of the shortest prefix of the text, that takes at least @p bytes
+ * in UTF-8. An offset in the middle of a character includes the whole character.
+ */
+qsizetype utf16Length(QStringView text, qsizetype bytes);
+
+/**
+ * UTF-8 offsets of a long line every ChunkSize UTF-16 units, so that a column of
+ * the line is converted by counting from the closest checkpoint instead of from
+ * the start of the line. Edits of the line move the checkpoints after them, so
+ * only the chunk, that was edited, is counted again.
+ */
+class ColumnIndex {
+  public:
+    struct Checkpoint {
+        qsizetype utf16 = 0;
+        qsizetype utf8 = 0;
+    };
+
+    /**
+     * Units [from, to) of the line as it is after the last edit.
+     */
+    using TextSource = std::function<QString(qsizetype from, qsizetype to)>;
+
+    ColumnIndex() = default;
+    explicit ColumnIndex(QStringView line);
+
+    /**
+     * Updates the index after @p removed units at @p column were replaced with @p added ones.
+     */
+    void replace(qsizetype column, qsizetype removed, qsizetype added, const TextSource &text);
+
+    /**
+     * Last checkpoint at or before the UTF-16 column.
+     */
+    Checkpoint checkpoint(qsizetype utf16Column) const;
+
+    /**
+     * Last checkpoint at or before the byte column.
+     */
+    Checkpoint checkpointForBytes(qsizetype utf8Column) const;
+
+    /**
+     * Checkpoints are at most ChunkSize apart, or one unit more to not split a surrogate pair.
+     * Edits may leave them closer.
+     */
+    static constexpr qsizetype ChunkSize = 1024;
+
+  private:
+    /**
+     * Checkpoints of the text after @p start, that ends at a checkpoint or the end of the line.
+     *
+     * @return checkpoint at the end of the text
+     */
+    static Checkpoint index(QStringView text, Checkpoint start, QList<Checkpoint> &checkpoints);
+
+    QList<Checkpoint> mCheckpoints;
+    qsizetype mLength = 0;
+};
+
+} // namespace Internal
+} // namespace QNVim